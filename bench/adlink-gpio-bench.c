@@ -0,0 +1,364 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * adlink-gpio-bench -- edge rate and latency benchmark of the ADLINK GPIO
+ * drivers on gpio-sim lines
+ *
+ * Injects rising edges by writing the sim_gpioN/pull attributes of a gpio-sim
+ * bank and reads the resulting events back, either from an adlink event
+ * device (/dev/adlink-*) or from a PPS device (/dev/ppsN). Reports injected,
+ * delivered, dropped (ring overruns) and coalesced (never seen) edges, plus
+ * percentiles of the injection to hard IRQ timestamp latency.
+ *
+ *	adlink-gpio-bench -d /dev/adlink-fsync-sim \
+ *		-p /sys/devices/platform/gpio-sim.0/gpiochip1/sim_gpio0/pull \
+ *		-p /sys/devices/platform/gpio-sim.0/gpiochip1/sim_gpio1/pull \
+ *		-r 10000 -n 100000 -b 4
+ *
+ * With several -p options the edges go round robin over the lines, channel
+ * N of the event records being the Nth line.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/pps.h>
+
+#include "adlink-gpio-event.h"
+
+#define MAX_LINES	32
+#define READ_BATCH	256
+#define DRAIN_MS	200	/* wait for late events after the last edge */
+
+struct line {
+	int fd;				/* sim_gpioN/pull */
+	uint64_t *inject_ns;		/* CLOCK_REALTIME of each injected edge */
+	uint64_t nr_injected;
+	uint64_t next_match;		/* first injection not matched yet */
+};
+
+static struct line lines[MAX_LINES];
+static unsigned int nr_lines;
+
+static const char *dev_path;
+static bool pps_mode;
+static unsigned int rate = 1000;	/* edges per second */
+static unsigned int burst = 1;		/* edges back to back per period */
+static uint64_t total = 10000;
+static bool csv;
+
+static uint64_t *latencies;
+static uint64_t nr_latencies;
+static uint64_t nr_delivered, nr_dropped, nr_unmatched;
+static volatile bool injecting = true;
+
+static uint64_t now_ns(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static void pull(struct line *l, bool up)
+{
+	const char *val = up ? "pull-up" : "pull-down";
+
+	if (pwrite(l->fd, val, strlen(val), 0) < 0)
+		die("write pull");
+}
+
+/*
+ * Match an event of @ch stamped at @ns to the latest injection at or before
+ * it. Older unmatched injections of the line were coalesced or dropped.
+ */
+static void account(unsigned int ch, uint64_t ns)
+{
+	struct line *l;
+	uint64_t i, injected;
+
+	nr_delivered++;
+	if (ch >= nr_lines) {
+		nr_unmatched++;
+		return;
+	}
+
+	l = &lines[ch];
+	// Written by the injector before the edge, read after the event
+	injected = __atomic_load_n(&l->nr_injected, __ATOMIC_ACQUIRE);
+	i = l->next_match;
+	if (i >= injected || l->inject_ns[i] > ns) {
+		nr_unmatched++;
+		return;
+	}
+	while (i + 1 < injected && l->inject_ns[i + 1] <= ns)
+		i++;
+
+	latencies[nr_latencies++] = ns - l->inject_ns[i];
+	l->next_match = i + 1;
+}
+
+static void read_evdev(int fd)
+{
+	struct adlink_gpio_event ev[READ_BATCH];
+	uint64_t expect_seq = 0;
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	ssize_t len;
+	size_t i;
+	int ret;
+
+	for (;;) {
+		ret = poll(&pfd, 1, injecting ? 1000 : DRAIN_MS);
+		if (ret < 0 && errno != EINTR)
+			die("poll");
+		// Nothing to read, a blocking read() would wait for the next edge
+		if (ret <= 0) {
+			if (!injecting)
+				break;
+			continue;
+		}
+
+		len = read(fd, ev, sizeof(ev));
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			die("read");
+		}
+
+		for (i = 0; i < len / sizeof(ev[0]); i++) {
+			// The kernel keeps counting sequence numbers across overruns
+			if (ev[i].seq != expect_seq)
+				nr_dropped += ev[i].seq - expect_seq;
+			expect_seq = ev[i].seq + 1;
+			account(ev[i].channel, ev[i].ns);
+		}
+	}
+}
+
+static void read_pps(int fd)
+{
+	struct pps_fdata fdata;
+	uint32_t last_seq = 0;
+	bool first = true;
+
+	for (;;) {
+		memset(&fdata, 0, sizeof(fdata));
+		fdata.timeout.sec = 0;
+		fdata.timeout.nsec = DRAIN_MS * 1000000;
+		if (ioctl(fd, PPS_FETCH, &fdata) < 0) {
+			if (errno == ETIMEDOUT) {
+				if (!injecting)
+					break;
+				continue;
+			}
+			if (errno == EINTR)
+				continue;
+			die("PPS_FETCH");
+		}
+
+		// PPS only keeps the last edge, anything in between is coalesced
+		if (!first && fdata.info.assert_sequence == last_seq)
+			continue;
+		first = false;
+		last_seq = fdata.info.assert_sequence;
+		account(0, (uint64_t)fdata.info.assert_tu.sec * 1000000000ULL +
+			fdata.info.assert_tu.nsec);
+	}
+}
+
+static void *reader(void *arg)
+{
+	int fd;
+
+	fd = open(dev_path, pps_mode ? O_RDWR : O_RDONLY);
+	if (fd < 0)
+		die(dev_path);
+
+	// Ready before the first edge
+	__atomic_store_n((int *)arg, 1, __ATOMIC_RELEASE);
+
+	if (pps_mode)
+		read_pps(fd);
+	else
+		read_evdev(fd);
+
+	close(fd);
+	return NULL;
+}
+
+static void inject(void)
+{
+	uint64_t period = 1000000000ULL * burst / rate;
+	struct timespec next;
+	uint64_t n = 0;
+	unsigned int i;
+	struct line *l;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (n < total) {
+		for (i = 0; i < burst && n < total; i++, n++) {
+			l = &lines[n % nr_lines];
+			pull(l, false);
+			l->inject_ns[l->nr_injected] = now_ns(CLOCK_REALTIME);
+			__atomic_store_n(&l->nr_injected, l->nr_injected + 1, __ATOMIC_RELEASE);
+			pull(l, true);
+		}
+
+		next.tv_nsec += period;
+		while (next.tv_nsec >= 1000000000L) {
+			next.tv_nsec -= 1000000000L;
+			next.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(double p)
+{
+	if (!nr_latencies)
+		return 0;
+	return latencies[(uint64_t)(p * (nr_latencies - 1))];
+}
+
+static void report(uint64_t elapsed_ns)
+{
+	uint64_t coalesced = total - (nr_delivered - nr_unmatched) - nr_dropped;
+
+	qsort(latencies, nr_latencies, sizeof(*latencies), cmp_u64);
+
+	if (csv) {
+		printf("%s,%u,%u,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n",
+		       dev_path, rate, burst,
+		       (unsigned long long)total, (unsigned long long)nr_delivered,
+		       (unsigned long long)nr_dropped, (unsigned long long)coalesced,
+		       (unsigned long long)nr_unmatched,
+		       (unsigned long long)percentile(0.50),
+		       (unsigned long long)percentile(0.90),
+		       (unsigned long long)percentile(0.99),
+		       (unsigned long long)percentile(0.999),
+		       (unsigned long long)(nr_latencies ? latencies[nr_latencies - 1] : 0));
+		return;
+	}
+
+	printf("device     %s\n", dev_path);
+	printf("rate       %u edges/s, bursts of %u, achieved %.0f edges/s\n",
+	       rate, burst, total * 1e9 / elapsed_ns);
+	printf("injected   %llu\n", (unsigned long long)total);
+	printf("delivered  %llu\n", (unsigned long long)nr_delivered);
+	printf("dropped    %llu (ring overruns)\n", (unsigned long long)nr_dropped);
+	printf("coalesced  %llu\n", (unsigned long long)coalesced);
+	if (nr_unmatched)
+		printf("unmatched  %llu (events without an injected edge)\n",
+		       (unsigned long long)nr_unmatched);
+	printf("latency    p50 %llu  p90 %llu  p99 %llu  p99.9 %llu  max %llu ns\n",
+	       (unsigned long long)percentile(0.50),
+	       (unsigned long long)percentile(0.90),
+	       (unsigned long long)percentile(0.99),
+	       (unsigned long long)percentile(0.999),
+	       (unsigned long long)(nr_latencies ? latencies[nr_latencies - 1] : 0));
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s -d DEV -p PULL [-p PULL...] [-r RATE] [-b BURST] [-n COUNT] [-c]\n"
+		"  -d DEV    /dev/adlink-* event device or /dev/ppsN\n"
+		"  -p PULL   sim_gpioN/pull attribute of an input line, once per channel\n"
+		"  -r RATE   edges per second (default %u)\n"
+		"  -b BURST  edges injected back to back per period (default %u)\n"
+		"  -n COUNT  edges in total (default %llu)\n"
+		"  -c        print one CSV line: dev,rate,burst,injected,delivered,\n"
+		"            dropped,coalesced,unmatched,p50,p90,p99,p99.9,max\n",
+		prog, rate, burst, (unsigned long long)total);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t start, elapsed;
+	pthread_t thread;
+	int ready = 0;
+	unsigned int i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:p:r:b:n:c")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev_path = optarg;
+			break;
+		case 'p':
+			if (nr_lines == MAX_LINES)
+				usage(argv[0]);
+			lines[nr_lines].fd = open(optarg, O_WRONLY);
+			if (lines[nr_lines].fd < 0)
+				die(optarg);
+			nr_lines++;
+			break;
+		case 'r':
+			rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			burst = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			total = strtoull(optarg, NULL, 0);
+			break;
+		case 'c':
+			csv = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!dev_path || !nr_lines || !rate || !burst || !total)
+		usage(argv[0]);
+	pps_mode = !strncmp(dev_path, "/dev/pps", 8);
+
+	latencies = calloc(total, sizeof(*latencies));
+	if (!latencies)
+		die("calloc");
+	for (i = 0; i < nr_lines; i++) {
+		lines[i].inject_ns = calloc(total / nr_lines + 1, sizeof(uint64_t));
+		if (!lines[i].inject_ns)
+			die("calloc");
+		pull(&lines[i], true);
+	}
+
+	if (pthread_create(&thread, NULL, reader, &ready))
+		die("pthread_create");
+	while (!__atomic_load_n(&ready, __ATOMIC_ACQUIRE))
+		usleep(1000);
+
+	start = now_ns(CLOCK_MONOTONIC);
+	inject();
+	elapsed = now_ns(CLOCK_MONOTONIC) - start;
+	injecting = false;
+	pthread_join(thread, NULL);
+
+	report(elapsed);
+
+	return 0;
+}
@@ -0,0 +1,182 @@
+/*
+ * adlink-gpio-sim.c -- bind the ADLINK GPIO drivers to gpio-sim lines
+ *
+ * Creates the platform devices of the capture drivers without a device tree
+ * and maps their GPIOs to a gpio-sim bank with gpiod lookup tables, so the
+ * drivers can be exercised on any machine. Line layout of the bank:
+ *
+ *	0..3	adlink-fsync-gpio	dser-gpios, channel 0..3
+ *	4	adlink-pps-mcu		pps-mcu-gpios (served by adlink-pps-gpio.ko)
+ *	5	adlink-pps-i210		pps-in-gpios (served by adlink-pps-gpio.ko)
+ *	6	adlink-pps-gpio		pps-in-gpios (no PPS_OUT, no GPRMC)
+ *
+ * Edges are injected by writing pull-up/pull-down to the sim_gpioN/pull
+ * attributes of the bank, see run-bench.sh.
+ *
+ * With ptp_index=N the I210 input names /dev/ptpN as its source, any PHC of
+ * the machine can stand in for the I210 one.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/platform_device.h>
+#include <linux/property.h>
+#include <linux/gpio/machine.h>
+#include <linux/slab.h>
+
+#define SIM_FSYNC_CHANNELS	4
+#define SIM_LINE_FSYNC		0
+#define SIM_LINE_PPS_MCU	4
+#define SIM_LINE_PPS_I210	5
+#define SIM_LINE_PPS_GPIO	6
+
+static char *chip = "adlink-sim";
+module_param(chip, charp, 0444);
+MODULE_PARM_DESC(chip, "Label of the gpio-sim bank");
+
+static char *drivers = "fsync,mcu,i210,pps";
+module_param(drivers, charp, 0444);
+MODULE_PARM_DESC(drivers, "Comma separated drivers to instantiate: fsync, mcu, i210, pps");
+
+static int ptp_index = -1;
+module_param(ptp_index, int, 0444);
+MODULE_PARM_DESC(ptp_index, "PHC the I210 input names as its source, /dev/ptp<ptp_index>, -1: none");
+
+static const struct property_entry sim_props[] = {
+	PROPERTY_ENTRY_STRING("label", "sim"),
+	{ }
+};
+
+// ptp-clock-index is filled in from ptp_index at load time
+static struct property_entry sim_i210_props[] = {
+	PROPERTY_ENTRY_STRING("label", "sim"),
+	PROPERTY_ENTRY_U32("ptp-clock-index", 0),
+	{ }
+};
+
+struct sim_binding {
+	const char *key;		/* name in the drivers parameter */
+	const char *dev_name;		/* platform driver to bind */
+	const char *con_id;		/* <con_id>-gpios */
+	unsigned int line;		/* first line on the bank */
+	unsigned int nr_lines;
+	const struct property_entry *props;	/* sim_props if NULL */
+	struct gpiod_lookup_table *lookup;
+	struct platform_device *pdev;
+};
+
+#define SIM_BINDING_I210	2
+
+static struct sim_binding sim_bindings[] = {
+	{ "fsync", "adlink-fsync-gpio", "dser", SIM_LINE_FSYNC, SIM_FSYNC_CHANNELS },
+	{ "mcu", "adlink-pps-mcu", "pps-mcu", SIM_LINE_PPS_MCU, 1 },
+	{ "i210", "adlink-pps-i210", "pps-in", SIM_LINE_PPS_I210, 1 },
+	{ "pps", "adlink-pps-gpio", "pps-in", SIM_LINE_PPS_GPIO, 1 },
+};
+
+static bool sim_wanted(const char *key)
+{
+	size_t len = strlen(key);
+	const char *p = drivers;
+
+	while ((p = strstr(p, key))) {
+		if ((p == drivers || p[-1] == ',') && (p[len] == ',' || !p[len]))
+			return true;
+		p += len;
+	}
+
+	return false;
+}
+
+static void sim_unbind(struct sim_binding *b)
+{
+	if (!IS_ERR_OR_NULL(b->pdev))
+		platform_device_unregister(b->pdev);
+	b->pdev = NULL;
+
+	if (b->lookup) {
+		gpiod_remove_lookup_table(b->lookup);
+		kfree(b->lookup);
+		b->lookup = NULL;
+	}
+}
+
+static int sim_bind(struct sim_binding *b)
+{
+	struct platform_device_info info = {
+		.name = b->dev_name,
+		.id = PLATFORM_DEVID_NONE,
+		.properties = b->props ? b->props : sim_props,
+	};
+	unsigned int i;
+
+	// One entry per line plus the terminator
+	b->lookup = kzalloc(struct_size(b->lookup, table, b->nr_lines + 1), GFP_KERNEL);
+	if (!b->lookup)
+		return -ENOMEM;
+
+	b->lookup->dev_id = b->dev_name;
+	for (i = 0; i < b->nr_lines; i++)
+		b->lookup->table[i] = (struct gpiod_lookup)
+			GPIO_LOOKUP_IDX(chip, b->line + i, b->con_id, i, GPIO_ACTIVE_HIGH);
+	gpiod_add_lookup_table(b->lookup);
+
+	b->pdev = platform_device_register_full(&info);
+	if (IS_ERR(b->pdev)) {
+		pr_err("failed to create %s: %ld\n", b->dev_name, PTR_ERR(b->pdev));
+		return PTR_ERR(b->pdev);
+	}
+
+	pr_info("%s bound to %s lines %u..%u\n", b->dev_name, chip, b->line,
+		b->line + b->nr_lines - 1);
+
+	return 0;
+}
+
+static void sim_unbind_all(void)
+{
+	int i;
+
+	for (i = ARRAY_SIZE(sim_bindings) - 1; i >= 0; i--)
+		sim_unbind(&sim_bindings[i]);
+}
+
+static int __init adlink_gpio_sim_init(void)
+{
+	unsigned int i;
+	int ret;
+
+	if (ptp_index >= 0) {
+		sim_i210_props[1] = PROPERTY_ENTRY_U32("ptp-clock-index", ptp_index);
+		sim_bindings[SIM_BINDING_I210].props = sim_i210_props;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(sim_bindings); i++) {
+		if (!sim_wanted(sim_bindings[i].key))
+			continue;
+
+		ret = sim_bind(&sim_bindings[i]);
+		if (ret) {
+			sim_unbind_all();
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+static void __exit adlink_gpio_sim_exit(void)
+{
+	sim_unbind_all();
+}
+
+module_init(adlink_gpio_sim_init);
+module_exit(adlink_gpio_sim_exit);
+MODULE_AUTHOR("Ting Chang <ting.chang@adlinktech.com>");
+MODULE_DESCRIPTION("Bind the ADLINK GPIO drivers to gpio-sim lines");
+MODULE_LICENSE("GPL");
+MODULE_VERSION("1.0.0");
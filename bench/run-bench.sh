@@ -0,0 +1,83 @@
+#!/bin/bash
+#
+# Sweep the edge rate of every driver on a gpio-sim bank and report the
+# highest rate each one sustains without dropped or coalesced edges.
+#
+#   sudo ./run-bench.sh [-n COUNT] [-b BURST] [-r "RATE RATE ..."] [DRIVER...]
+#
+# DRIVER is any of fsync, mcu, i210, pps (default all). Needs CONFIG_GPIO_SIM,
+# configfs and the modules built by `make` in this directory.
+
+set -e
+
+cd "$(dirname "$0")"
+
+COUNT=10000
+BURST=1
+RATES="100 1000 5000 10000 20000 50000 100000"
+CONFIGFS=/sys/kernel/config/gpio-sim/adlink-bench
+
+while getopts "n:b:r:" opt; do
+	case $opt in
+	n) COUNT=$OPTARG ;;
+	b) BURST=$OPTARG ;;
+	r) RATES=$OPTARG ;;
+	*) exit 2 ;;
+	esac
+done
+shift $((OPTIND - 1))
+DRIVERS=${*:-fsync mcu i210 pps}
+
+cleanup() {
+	rmmod adlink-gpio-sim adlink-fsync-gpio adlink-pps-gpio adlink-gpio-lib 2>/dev/null || true
+	if [ -d $CONFIGFS ]; then
+		echo 0 > $CONFIGFS/live
+		rmdir $CONFIGFS/bank0 $CONFIGFS
+	fi
+}
+trap cleanup EXIT
+
+# One bank of 7 lines, the layout is described in adlink-gpio-sim.c
+modprobe gpio-sim
+mountpoint -q /sys/kernel/config || mount -t configfs none /sys/kernel/config
+mkdir -p $CONFIGFS/bank0
+echo adlink-sim > $CONFIGFS/bank0/label
+echo 7 > $CONFIGFS/bank0/num_lines
+echo 1 > $CONFIGFS/live
+SIM_DIR=/sys/devices/platform/$(cat $CONFIGFS/dev_name)/$(cat $CONFIGFS/bank0/chip_name)
+
+insmod ../src/adlink-gpio-lib.ko
+for mod in adlink-fsync-gpio adlink-pps-gpio; do
+	insmod ../src/$mod.ko
+done
+insmod ./adlink-gpio-sim.ko chip=adlink-sim drivers="$(echo $DRIVERS | tr ' ' ',')"
+
+pulls() {
+	local line
+	for line in "$@"; do
+		echo "-p $SIM_DIR/sim_gpio$line/pull"
+	done
+}
+
+echo "dev,rate,burst,injected,delivered,dropped,coalesced,unmatched,p50,p90,p99,p99.9,max"
+for drv in $DRIVERS; do
+	case $drv in
+	fsync) dev=/dev/adlink-fsync-sim; lines="0 1 2 3" ;;
+	mcu)   dev=/dev/adlink-pps-mcu-sim; lines=4 ;;
+	i210)  dev=/dev/adlink-pps-i210-sim; lines=5 ;;
+	pps)   dev=$(grep -lx adlink-pps-gpio /sys/class/pps/pps*/name | head -1 | xargs dirname)
+	       dev=/dev/$(basename $dev); lines=6 ;;
+	*)     echo "unknown driver $drv" >&2; exit 2 ;;
+	esac
+
+	best=0
+	for rate in $RATES; do
+		result=$(./adlink-gpio-bench -c -d $dev $(pulls $lines) \
+			-r $rate -b $BURST -n $COUNT)
+		echo "$result"
+		# dropped and coalesced are fields 6 and 7
+		lost=$(echo "$result" | awk -F, '{ print $6 + $7 }')
+		[ "$lost" -eq 0 ] && best=$rate
+	done
+	echo "# $drv: max sustained rate $best edges/s" >&2
+done
@@ -4,26 +4,117 @@
 #include <linux/platform_device.h>
 #include <linux/delay.h>
 #include <linux/of_gpio.h>
+#include <linux/kthread.h>
+#include <linux/hrtimer.h>
+#include <linux/sched.h>
+#include <linux/mutex.h>
+
+#include "adlink-gpio-event.h"
+#include "adlink-lib.h"
+#include "adlink-trace.h"
 
 #define DRIVER_NAME "adlink-base-gpio"
+#define BASE_POLL_MIN_US 100		// about one I2C read of the expander
+#define BASE_POLL_MAX_US 1000000
+#define BASE_MAX_PINS 32		// one bit per pin in the snapshot
 
 struct base_gpio_device_data {
-	int irq;
-	bool base_gpio;
-	time64_t time;
+	int irq;			/* -1 when polling */
 	struct gpio_desc *base_gpio_desc;	/* GPIO port descriptors */
+	struct adlink_irqstat *irqstat;
+	struct adlink_evdev *evdev;	/* edges for userspace, channel N is pin N */
+
+	/*
+	 * Optional "gpios" array, read with one array access per interrupt or
+	 * poll, a single I2C transfer for pins of one expander. Channel N of
+	 * the edge events is the Nth pin.
+	 */
+	struct gpio_descs *pins;
+	int *pin_irqs;			/* [pins->ndescs], IRQ of each pin */
+	struct mutex scan_lock;		/* pins may sit on expanders with separate IRQ threads */
+	unsigned long snapshot;		/* pin levels of the last read */
+	unsigned long reported;		/* changes seen before their own pin IRQ ran */
+	unsigned long read_errors;
+
+	/*
+	 * Polling instead of the IRQ, for expanders whose interrupt does not
+	 * fire. The interval starts at poll_min_us after an edge and doubles
+	 * with every idle read up to poll_max_us.
+	 */
+	struct task_struct *poll_task;
+	u32 poll_min_us;
+	u32 poll_max_us;
+	u32 poll_interval_us;		/* current interval */
+	u64 polls;			/* expander reads */
 };
 
-// Top ISR, deal with the real-time tasks
-static irqreturn_t _irq_top_handler(int irq, void *data)
+// Report one rising edge at @nsec, shared by the IRQ and the polling thread
+static void base_gpio_edge(struct base_gpio_device_data *data, u64 nsec)
 {
-	// Get the time stamp
-	struct base_gpio_device_data *_data = data;
-	_data->time = ktime_get_real_seconds();
-	
-	printk("irq=%d, _irq_top_handler", irq);
-	
-	return IRQ_WAKE_THREAD; // schedule the bottom half
+	u64 start = adlink_irqstat_thread_begin(data->irqstat);
+	u64 seq;
+
+	seq = adlink_evdev_push(data->evdev, nsec, 0, 0, 0);
+	trace_adlink_gpio_thread(data->irq, 0, seq, nsec);
+
+	adlink_irqstat_thread_end(data->irqstat, start);
+}
+
+/*
+ * Read all pins at once and report every pin that changed since the last
+ * read as an edge at @nsec. Returns the number of changed pins.
+ *
+ * @pin is the pin whose own IRQ asks for the scan, or -1. The expander runs
+ * the nested IRQs of all pins that changed together one after the other, so
+ * the first of them reads for all and the others only consume their bit.
+ * Dropping a bit too early only costs an extra read, keeping a stale one
+ * costs the next edge of the pin, so a bit goes once the pin changes again.
+ */
+static int base_gpio_scan(struct base_gpio_device_data *data, int irq, int pin,
+			  u64 nsec)
+{
+	u64 start = adlink_irqstat_thread_begin(data->irqstat);
+	DECLARE_BITMAP(values, BASE_MAX_PINS) = { 0 };
+	unsigned long changed;
+	unsigned int i;
+	u32 flags;
+	u64 seq;
+	int ret;
+
+	mutex_lock(&data->scan_lock);
+	if (pin >= 0 && test_and_clear_bit(pin, &data->reported)) {
+		ret = 0;
+		goto out;
+	}
+
+	ret = gpiod_get_array_value_cansleep(data->pins->ndescs, data->pins->desc,
+					     data->pins->info, values);
+	if (ret) {
+		data->read_errors++;
+		goto out;
+	}
+
+	changed = values[0] ^ data->snapshot;
+	data->snapshot = values[0];
+	for_each_set_bit(i, &changed, data->pins->ndescs) {
+		flags = test_bit(i, values) ? 0 : ADLINK_GPIO_EVENT_FALLING;
+		seq = adlink_evdev_push(data->evdev, nsec, 0, flags, i);
+		trace_adlink_gpio_edge(irq, i, seq, nsec, 0, flags);
+	}
+	/*
+	 * Their own IRQs are still to come in this run of the expander. A pin
+	 * that was marked and changed again is back where its IRQ may never
+	 * fire, so drop the mark rather than swallow its next real edge.
+	 */
+	if (pin >= 0)
+		data->reported ^= changed & ~BIT(pin);
+	else
+		data->reported &= ~changed;
+	ret = hweight_long(changed);
+out:
+	mutex_unlock(&data->scan_lock);
+	adlink_irqstat_thread_end(data->irqstat, start);
+	return ret;
 }
 
 // Bottom ISR, run the remain tasks after Top ISR
@@ -31,12 +122,98 @@ static irqreturn_t _irq_bottom_handler(int irq, void *data)
 {
 	struct base_gpio_device_data *_data = data;
 
-	// TODO: Do we need spin_lock here?
-	printk("irq=%d, _irq_bottom_handler", irq);
+	// Nested IRQ, so this is the first place to see the edge
+	if (_data->pins)
+		base_gpio_scan(_data, irq, -1, ktime_get_real_ns());
+	else
+		base_gpio_edge(_data, ktime_get_real_ns());
+
+	return IRQ_HANDLED;
+}
+
+// Nested IRQ of one pin of the gpios array, a single read covers all pins of the batch
+static irqreturn_t _irq_pins_handler(int irq, void *data)
+{
+	struct base_gpio_device_data *_data = data;
+	int pin;
+
+	for (pin = _data->pins->ndescs - 1; pin >= 0; pin--) {
+		if (_data->pin_irqs[pin] == irq)
+			break;
+	}
+	base_gpio_scan(_data, irq, pin, ktime_get_real_ns());
 
 	return IRQ_HANDLED;
 }
 
+static int base_gpio_poll_thread(void *arg)
+{
+	struct base_gpio_device_data *data = arg;
+	u64 prev_ns = ktime_get_real_ns();
+	int last = data->pins ? 0 : gpiod_get_value_cansleep(data->base_gpio_desc);
+	u32 interval = READ_ONCE(data->poll_min_us);
+	ktime_t timeout;
+	int changed;
+	int level;
+	u64 now;
+
+	while (!kthread_should_stop()) {
+		// Allow 1/8 of slack, so that idle reads can share a wakeup with other timers
+		timeout = us_to_ktime(interval);
+		set_current_state(TASK_INTERRUPTIBLE);
+		schedule_hrtimeout_range(&timeout, interval * (NSEC_PER_USEC / 8),
+					 HRTIMER_MODE_REL);
+		if (kthread_should_stop())
+			break;
+
+		// An edge happened between the two reads, stamp it in the middle
+		now = ktime_get_real_ns();
+		WRITE_ONCE(data->polls, data->polls + 1);
+		if (data->pins) {
+			changed = base_gpio_scan(data, -1, -1, prev_ns + (now - prev_ns) / 2);
+		} else {
+			level = gpiod_get_value_cansleep(data->base_gpio_desc);
+			changed = level < 0 ? level : level && !last;
+			if (changed > 0)
+				base_gpio_edge(data, prev_ns + (now - prev_ns) / 2);
+			if (level >= 0)
+				last = level;
+		}
+		prev_ns = now;
+
+		// A failing read backs off fully, but still follows the sysfs limits
+		if (changed < 0)
+			interval = READ_ONCE(data->poll_max_us);
+		else if (changed)
+			interval = READ_ONCE(data->poll_min_us);
+		else
+			interval = min(interval * 2, READ_ONCE(data->poll_max_us));
+		interval = max(interval, READ_ONCE(data->poll_min_us));
+		WRITE_ONCE(data->poll_interval_us, interval);
+	}
+
+	return 0;
+}
+
+static void base_gpio_poll_stop(void *data)
+{
+	kthread_stop(data);
+}
+
+static int base_gpio_poll_start(struct device *dev)
+{
+	struct base_gpio_device_data *data = dev_get_drvdata(dev);
+
+	data->poll_task = kthread_run(base_gpio_poll_thread, data, "poll/%s", dev_name(dev));
+	if (IS_ERR(data->poll_task))
+		return PTR_ERR(data->poll_task);
+
+	// Same priority as the IRQ thread it replaces
+	sched_set_fifo(data->poll_task);
+
+	return devm_add_action_or_reset(dev, base_gpio_poll_stop, data->poll_task);
+}
+
 
 static int base_gpio_setup(struct device *dev)
 {
@@ -47,11 +224,51 @@ static int base_gpio_setup(struct device *dev)
     device_property_read_string(dev, "interrupt", &ptr);
     dev_info(dev, "interrupt=%s", ptr);
 
-	data->base_gpio_desc = devm_gpiod_get(dev, "interrupt", GPIOD_IN);
+	// Optional pins read in one go on every interrupt or poll
+	data->pins = devm_gpiod_get_array_optional(dev, NULL, GPIOD_IN);
+	if (IS_ERR(data->pins)) {
+		return dev_err_probe(dev, PTR_ERR(data->pins),
+				     "failed to request gpios");
+	}
+
+	// Only optional with a gpios array
+	if (data->pins)
+		data->base_gpio_desc = devm_gpiod_get_optional(dev, "interrupt", GPIOD_IN);
+	else
+		data->base_gpio_desc = devm_gpiod_get(dev, "interrupt", GPIOD_IN);
 	if (IS_ERR(data->base_gpio_desc)) {
 		return dev_err_probe(dev, PTR_ERR(data->base_gpio_desc),
 				     "failed to request base-gpios");
 	}
+
+	if (data->pins) {
+		DECLARE_BITMAP(values, BASE_MAX_PINS) = { 0 };
+
+		if (data->pins->ndescs > BASE_MAX_PINS) {
+			dev_err(dev, "%u gpios, at most %u are supported\n",
+				data->pins->ndescs, BASE_MAX_PINS);
+			return -EINVAL;
+		}
+		ret = gpiod_get_array_value_cansleep(data->pins->ndescs, data->pins->desc,
+						     data->pins->info, values);
+		if (ret)
+			return dev_err_probe(dev, ret, "failed to read gpios");
+		data->snapshot = values[0];
+	}
+
+	// Polling is optional, it replaces the IRQ when poll-interval-us is given
+	if (device_property_read_u32(dev, "poll-interval-us", &data->poll_min_us))
+		return 0;
+	data->poll_max_us = data->poll_min_us;
+	device_property_read_u32(dev, "poll-interval-max-us", &data->poll_max_us);
+	if (data->poll_min_us < BASE_POLL_MIN_US || data->poll_max_us > BASE_POLL_MAX_US ||
+	    data->poll_max_us < data->poll_min_us) {
+		dev_err(dev, "invalid poll-interval-us %u or poll-interval-max-us %u\n",
+			data->poll_min_us, data->poll_max_us);
+		return -EINVAL;
+	}
+	data->poll_interval_us = data->poll_min_us;
+
 	return 0;
 }
 
@@ -59,6 +276,8 @@ static int base_gpio_probe(struct platform_device *pdev)
 {
 	struct base_gpio_device_data *data;
 	struct device *dev = &(pdev->dev);
+	unsigned int i;
+	int irq;
 	int ret;
 
 	dev_info(dev, "starting base_gpio_probe\n");
@@ -69,6 +288,7 @@ static int base_gpio_probe(struct platform_device *pdev)
 		return -ENOMEM;
 
 	dev_set_drvdata(dev, data);
+	mutex_init(&data->scan_lock);
 
 	/* GPIO setup */
 	ret = base_gpio_setup(dev);
@@ -77,7 +297,64 @@ static int base_gpio_probe(struct platform_device *pdev)
 		return ret;
     }
 
-	/* IRQ setup */
+	/* Latency instrumentation, only thread_runtime as there is no top half here */
+	data->irqstat = devm_adlink_irqstat_create(dev);
+	if (IS_ERR(data->irqstat)) {
+		dev_err(dev, "failed to create IRQ statistics\n");
+		return PTR_ERR(data->irqstat);
+	}
+
+	/* Event device setup, before the IRQs and the poll thread that feed it */
+	data->evdev = devm_adlink_evdev_create(dev, "adlink-base");
+	if (IS_ERR(data->evdev)) {
+		dev_err(dev, "failed to create event device\n");
+		return PTR_ERR(data->evdev);
+	}
+
+	/* Polling setup, instead of the IRQ */
+	if (data->poll_min_us) {
+		data->irq = -1;
+		ret = base_gpio_poll_start(dev);
+		if (ret) {
+			dev_err(dev, "failed to start polling: %d\n", ret);
+			return ret;
+		}
+
+		dev_info(dev, "Driver %s has been successfully probed, polling every %u..%u us\n",
+			 DRIVER_NAME, data->poll_min_us, data->poll_max_us);
+		return 0;
+	}
+
+	/* IRQ setup, one per pin of the gpios array, one scan serves the pins that changed together */
+	if (data->pins) {
+		data->pin_irqs = devm_kcalloc(dev, data->pins->ndescs,
+					      sizeof(*data->pin_irqs), GFP_KERNEL);
+		if (!data->pin_irqs)
+			return -ENOMEM;
+	}
+	for (i = 0; data->pins && i < data->pins->ndescs; i++) {
+		ret = gpiod_to_irq(data->pins->desc[i]);
+		if (ret < 0) {
+			dev_err(dev, "failed to map GPIO to IRQ: %d\n", ret);
+			return -EINVAL;
+		}
+
+		irq = ret;
+		data->pin_irqs[i] = irq;
+		ret = devm_request_threaded_irq(dev, irq, NULL, _irq_pins_handler,
+			IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING | IRQF_ONESHOT, DRIVER_NAME, data);
+		if (ret) {
+			dev_err(dev, "failed to acquire IRQ %d, ret=%d\n", irq, ret);
+			return -EINVAL;
+		}
+	}
+	if (!data->base_gpio_desc) {
+		data->irq = -1;
+		dev_info(dev, "Driver %s has been successfully probed, %u pins\n",
+			 DRIVER_NAME, data->pins->ndescs);
+		return 0;
+	}
+
 	ret = gpiod_to_irq(data->base_gpio_desc);
 	if (ret < 0) {
 		dev_err(dev, "failed to map GPIO to IRQ: %d\n", ret);
@@ -104,6 +381,146 @@ static int base_gpio_remove(struct platform_device *pdev)
 	return 0;
 }
 
+static ssize_t poll_interval_us_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
+{
+	struct base_gpio_device_data *data = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", READ_ONCE(data->poll_min_us));
+}
+
+static ssize_t poll_interval_us_store(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	struct base_gpio_device_data *data = dev_get_drvdata(dev);
+	u32 val;
+	int ret;
+
+	ret = kstrtou32(buf, 0, &val);
+	if (ret)
+		return ret;
+	if (val < BASE_POLL_MIN_US || val > READ_ONCE(data->poll_max_us))
+		return -EINVAL;
+
+	WRITE_ONCE(data->poll_min_us, val);
+
+	return count;
+}
+static DEVICE_ATTR_RW(poll_interval_us);
+
+static ssize_t poll_interval_max_us_show(struct device *dev,
+					 struct device_attribute *attr, char *buf)
+{
+	struct base_gpio_device_data *data = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", READ_ONCE(data->poll_max_us));
+}
+
+static ssize_t poll_interval_max_us_store(struct device *dev,
+					  struct device_attribute *attr,
+					  const char *buf, size_t count)
+{
+	struct base_gpio_device_data *data = dev_get_drvdata(dev);
+	u32 val;
+	int ret;
+
+	ret = kstrtou32(buf, 0, &val);
+	if (ret)
+		return ret;
+	if (val < READ_ONCE(data->poll_min_us) || val > BASE_POLL_MAX_US)
+		return -EINVAL;
+
+	WRITE_ONCE(data->poll_max_us, val);
+
+	return count;
+}
+static DEVICE_ATTR_RW(poll_interval_max_us);
+
+/* Interval of the last wait, shows how far polling has backed off */
+static ssize_t poll_interval_now_us_show(struct device *dev,
+					 struct device_attribute *attr, char *buf)
+{
+	struct base_gpio_device_data *data = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", READ_ONCE(data->poll_interval_us));
+}
+static DEVICE_ATTR_RO(poll_interval_now_us);
+
+static ssize_t polls_show(struct device *dev,
+			  struct device_attribute *attr, char *buf)
+{
+	struct base_gpio_device_data *data = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%llu\n", READ_ONCE(data->polls));
+}
+static DEVICE_ATTR_RO(polls);
+
+static ssize_t read_errors_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct base_gpio_device_data *data = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%lu\n", READ_ONCE(data->read_errors));
+}
+static DEVICE_ATTR_RO(read_errors);
+
+/* Levels of the gpios array as of the last read, bit N is pin N */
+static ssize_t pins_show(struct device *dev,
+			 struct device_attribute *attr, char *buf)
+{
+	struct base_gpio_device_data *data = dev_get_drvdata(dev);
+
+	return sprintf(buf, "0x%08lx\n", READ_ONCE(data->snapshot));
+}
+static DEVICE_ATTR_RO(pins);
+
+static struct attribute *base_gpio_pins_attrs[] = {
+	&dev_attr_pins.attr,
+	&dev_attr_read_errors.attr,
+	NULL,
+};
+
+// Only with a gpios array in DT
+static umode_t base_gpio_pins_visible(struct kobject *kobj, struct attribute *attr, int n)
+{
+	struct base_gpio_device_data *data = dev_get_drvdata(kobj_to_dev(kobj));
+
+	return data->pins ? attr->mode : 0;
+}
+
+static const struct attribute_group base_gpio_pins_group = {
+	.attrs = base_gpio_pins_attrs,
+	.is_visible = base_gpio_pins_visible,
+};
+
+static struct attribute *base_gpio_poll_attrs[] = {
+	&dev_attr_poll_interval_us.attr,
+	&dev_attr_poll_interval_max_us.attr,
+	&dev_attr_poll_interval_now_us.attr,
+	&dev_attr_polls.attr,
+	NULL,
+};
+
+// Only with polling enabled in DT
+static umode_t base_gpio_poll_visible(struct kobject *kobj, struct attribute *attr, int n)
+{
+	struct base_gpio_device_data *data = dev_get_drvdata(kobj_to_dev(kobj));
+
+	return data->poll_task ? attr->mode : 0;
+}
+
+static const struct attribute_group base_gpio_poll_group = {
+	.attrs = base_gpio_poll_attrs,
+	.is_visible = base_gpio_poll_visible,
+};
+
+static const struct attribute_group *base_gpio_groups[] = {
+	&base_gpio_poll_group,
+	&base_gpio_pins_group,
+	NULL,
+};
+
 static const struct of_device_id base_gpio_dt_ids[] = {
 	{ .compatible = DRIVER_NAME, },
 	{ /* sentinel */ }
@@ -116,6 +533,7 @@ static struct platform_driver base_gpio_driver = {
 	.driver		= {
 		.name	= DRIVER_NAME,
 		.of_match_table	= base_gpio_dt_ids,
+		.dev_groups	= base_gpio_groups,
 	},
 };
 
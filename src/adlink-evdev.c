@@ -0,0 +1,413 @@
+/*
+ * adlink-evdev.c -- edge event character device of the ADLINK GPIO drivers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/device.h>
+#include <linux/miscdevice.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/irq_work.h>
+#include <linux/kref.h>
+#include <linux/mutex.h>
+#include <linux/uaccess.h>
+#include <linux/log2.h>
+#include <linux/version.h>
+
+#include "adlink-gpio-event.h"
+#include "adlink-lib.h"
+#include "adlink-lib-priv.h"
+
+#define ADLINK_EVDEV_RECORDS_DEF 1024
+
+static unsigned int ring_records = ADLINK_EVDEV_RECORDS_DEF;
+module_param(ring_records, uint, 0444);
+MODULE_PARM_DESC(ring_records, "Event records per device, rounded up to a power of two");
+
+static unsigned int wakeup_watermark = 1;
+module_param(wakeup_watermark, uint, 0644);
+MODULE_PARM_DESC(wakeup_watermark, "Default number of pending records that wakes up readers");
+
+struct adlink_evdev {
+	struct kref ref;		/* devm owner plus one per open file */
+	struct miscdevice miscdev;
+
+	/* Ring shared read-only with userspace, header in page 0 */
+	struct adlink_gpio_ring_header *ring;
+	struct adlink_gpio_event *records;
+	u32 nr_records;
+	u64 seq;
+	bool overrun;
+
+	/* Reader side */
+	struct mutex read_lock;		/* serializes tail updates */
+	wait_queue_head_t wait;
+	struct irq_work wake_work;	/* wakes readers outside of hard IRQ context */
+	u32 watermark;
+	u64 flush_head;			/* records before it wake readers below the watermark */
+	bool dead;			/* the producer is gone */
+};
+
+static struct adlink_evdev *to_adlink_evdev(struct file *file)
+{
+	return container_of(file->private_data, struct adlink_evdev, miscdev);
+}
+
+static u64 adlink_evdev_pending(struct adlink_evdev *ed)
+{
+	return smp_load_acquire(&ed->ring->head) - READ_ONCE(ed->ring->tail);
+}
+
+static bool adlink_evdev_ready(struct adlink_evdev *ed)
+{
+	return READ_ONCE(ed->dead) ||
+		adlink_evdev_pending(ed) >= max(READ_ONCE(ed->watermark), 1U) ||
+		READ_ONCE(ed->flush_head) > READ_ONCE(ed->ring->tail);
+}
+
+u64 adlink_evdev_push_event(struct adlink_evdev *ed, const struct adlink_gpio_event *rec)
+{
+	struct adlink_gpio_ring_header *hdr = ed->ring;
+	struct adlink_gpio_event *ev;
+	u64 head = hdr->head;
+	u64 seq = ed->seq++;
+
+	if (head - smp_load_acquire(&hdr->tail) >= ed->nr_records) {
+		// Ring is full, never overwrite records the consumer still owns
+		WRITE_ONCE(hdr->overruns, hdr->overruns + 1);
+		ed->overrun = true;
+		return seq;
+	}
+
+	ev = &ed->records[head & (ed->nr_records - 1)];
+	*ev = *rec;
+	ev->seq = seq;
+	if (ed->overrun) {
+		ev->flags |= ADLINK_GPIO_EVENT_OVERRUN;
+		ed->overrun = false;
+	}
+
+	// Publish the record after its payload is visible
+	smp_store_release(&hdr->head, head + 1);
+
+	// Only pay for the wakeup when somebody sleeps and the batch is complete
+	if (wq_has_sleeper(&ed->wait) &&
+	    head + 1 - READ_ONCE(hdr->tail) >= READ_ONCE(ed->watermark))
+		irq_work_queue(&ed->wake_work);
+
+	return seq;
+}
+EXPORT_SYMBOL_GPL(adlink_evdev_push_event);
+
+u64 adlink_evdev_push(struct adlink_evdev *ed, u64 ns, u64 raw, u32 flags,
+		      u32 channel)
+{
+	struct adlink_gpio_event rec = {
+		.ns = ns,
+		.raw = raw,
+		.flags = flags,
+		.channel = channel,
+	};
+
+	return adlink_evdev_push_event(ed, &rec);
+}
+EXPORT_SYMBOL_GPL(adlink_evdev_push);
+
+u64 adlink_evdev_overruns(struct adlink_evdev *ed)
+{
+	return READ_ONCE(ed->ring->overruns);
+}
+EXPORT_SYMBOL_GPL(adlink_evdev_overruns);
+
+void adlink_evdev_flush(struct adlink_evdev *ed)
+{
+	u64 head = smp_load_acquire(&ed->ring->head);
+
+	WRITE_ONCE(ed->flush_head, head);
+	if (wq_has_sleeper(&ed->wait) && head != READ_ONCE(ed->ring->tail))
+		irq_work_queue(&ed->wake_work);
+}
+EXPORT_SYMBOL_GPL(adlink_evdev_flush);
+
+static void adlink_evdev_wake(struct irq_work *work)
+{
+	struct adlink_evdev *ed = container_of(work, struct adlink_evdev, wake_work);
+
+	wake_up_interruptible_poll(&ed->wait, EPOLLIN | EPOLLRDNORM);
+}
+
+static void adlink_evdev_free(struct kref *ref)
+{
+	struct adlink_evdev *ed = container_of(ref, struct adlink_evdev, ref);
+
+	vfree(ed->ring);
+	kfree(ed->miscdev.name);
+	kfree(ed);
+}
+
+static int adlink_evdev_open(struct inode *inode, struct file *file)
+{
+	// misc_open() holds misc_mtx, so the device cannot be deregistered meanwhile
+	kref_get(&to_adlink_evdev(file)->ref);
+
+	return stream_open(inode, file);
+}
+
+static int adlink_evdev_release(struct inode *inode, struct file *file)
+{
+	kref_put(&to_adlink_evdev(file)->ref, adlink_evdev_free);
+
+	return 0;
+}
+
+/* Copy out as many whole records as fit into @buf and release them */
+static ssize_t adlink_evdev_read(struct file *file, char __user *buf,
+				 size_t count, loff_t *ppos)
+{
+	struct adlink_evdev *ed = to_adlink_evdev(file);
+	struct adlink_gpio_ring_header *hdr = ed->ring;
+	size_t n, first;
+	u64 tail;
+	int ret;
+
+	if (count < sizeof(struct adlink_gpio_event))
+		return -EINVAL;
+
+	if (!(file->f_flags & O_NONBLOCK)) {
+		ret = wait_event_interruptible(ed->wait, adlink_evdev_ready(ed));
+		if (ret)
+			return ret;
+	}
+
+	if (mutex_lock_interruptible(&ed->read_lock))
+		return -ERESTARTSYS;
+
+	tail = hdr->tail;
+	n = min_t(u64, smp_load_acquire(&hdr->head) - tail,
+		  count / sizeof(struct adlink_gpio_event));
+	if (!n) {
+		ret = READ_ONCE(ed->dead) ? -ENODEV : -EAGAIN;
+		goto out;
+	}
+
+	// At most two chunks, the second one starts over at record 0
+	first = min_t(size_t, n, ed->nr_records - (tail & (ed->nr_records - 1)));
+	if (copy_to_user(buf, &ed->records[tail & (ed->nr_records - 1)],
+			 first * sizeof(struct adlink_gpio_event)) ||
+	    copy_to_user(buf + first * sizeof(struct adlink_gpio_event),
+			 ed->records, (n - first) * sizeof(struct adlink_gpio_event))) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	// The records are copied, hand the slots back to the producer
+	smp_store_release(&hdr->tail, tail + n);
+	ret = n * sizeof(struct adlink_gpio_event);
+out:
+	mutex_unlock(&ed->read_lock);
+	return ret;
+}
+
+static __poll_t adlink_evdev_poll(struct file *file, poll_table *wait)
+{
+	struct adlink_evdev *ed = to_adlink_evdev(file);
+
+	poll_wait(file, &ed->wait, wait);
+
+	if (READ_ONCE(ed->dead))
+		return EPOLLHUP | EPOLLERR;
+	if (adlink_evdev_ready(ed))
+		return EPOLLIN | EPOLLRDNORM;
+
+	return 0;
+}
+
+// vm_flags is read-only from 6.3 on, writes go through the vm_flags_*() helpers
+static void adlink_evdev_vma_clear(struct vm_area_struct *vma, unsigned long flags)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0)
+	vma->vm_flags &= ~flags;
+#else
+	vm_flags_clear(vma, flags);
+#endif
+}
+
+static int adlink_evdev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct adlink_evdev *ed = to_adlink_evdev(file);
+
+	// Userspace may only read the ring, the producer state lives in the kernel
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	adlink_evdev_vma_clear(vma, VM_MAYWRITE);
+
+	return remap_vmalloc_range(vma, ed->ring, vma->vm_pgoff);
+}
+
+static long adlink_evdev_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct adlink_evdev *ed = to_adlink_evdev(file);
+	struct adlink_gpio_ring_header *hdr = ed->ring;
+	long ret = 0;
+	u64 pos;
+
+	switch (cmd) {
+	case ADLINK_GPIO_IOC_RELEASE:
+		if (copy_from_user(&pos, (void __user *)arg, sizeof(pos)))
+			return -EFAULT;
+		mutex_lock(&ed->read_lock);
+		if (pos - hdr->tail > smp_load_acquire(&hdr->head) - hdr->tail)
+			ret = -EINVAL;
+		else
+			// The consumer is done with the records, hand the slots back
+			smp_store_release(&hdr->tail, pos);
+		mutex_unlock(&ed->read_lock);
+		return ret;
+	default:
+		return -ENOTTY;
+	}
+}
+
+static const struct file_operations adlink_evdev_fops = {
+	.owner		= THIS_MODULE,
+	.open		= adlink_evdev_open,
+	.release	= adlink_evdev_release,
+	.read		= adlink_evdev_read,
+	.poll		= adlink_evdev_poll,
+	.mmap		= adlink_evdev_mmap,
+	.unlocked_ioctl	= adlink_evdev_ioctl,
+	.compat_ioctl	= compat_ptr_ioctl,
+	.llseek		= no_llseek,
+};
+
+static ssize_t wakeup_watermark_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
+{
+	struct miscdevice *misc = dev_get_drvdata(dev);
+	struct adlink_evdev *ed = container_of(misc, struct adlink_evdev, miscdev);
+
+	return sprintf(buf, "%u\n", READ_ONCE(ed->watermark));
+}
+
+static ssize_t wakeup_watermark_store(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	struct miscdevice *misc = dev_get_drvdata(dev);
+	struct adlink_evdev *ed = container_of(misc, struct adlink_evdev, miscdev);
+	u32 val;
+	int ret;
+
+	ret = kstrtou32(buf, 0, &val);
+	if (ret)
+		return ret;
+	if (!val || val > ed->nr_records)
+		return -EINVAL;
+
+	WRITE_ONCE(ed->watermark, val);
+	// A lower watermark may already be reached
+	wake_up_interruptible_poll(&ed->wait, EPOLLIN | EPOLLRDNORM);
+
+	return count;
+}
+static DEVICE_ATTR_RW(wakeup_watermark);
+
+static struct attribute *adlink_evdev_attrs[] = {
+	&dev_attr_wakeup_watermark.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(adlink_evdev);
+
+static void adlink_evdev_unregister(void *data)
+{
+	struct adlink_evdev *ed = data;
+
+	misc_deregister(&ed->miscdev);
+
+	// Let blocked readers see the end of the stream
+	WRITE_ONCE(ed->dead, true);
+	irq_work_sync(&ed->wake_work);
+	wake_up_interruptible_all(&ed->wait);
+
+	kref_put(&ed->ref, adlink_evdev_free);
+}
+
+/*
+ * Create /dev/<prefix>-<label> for @dev, falling back to the device name
+ * when there is no "label" property. Must be called before the IRQ is
+ * requested, so that the device is removed only after the IRQ has been
+ * freed. Producers of one device have to be serialized by the caller.
+ */
+struct adlink_evdev *devm_adlink_evdev_create(struct device *dev, const char *prefix)
+{
+	struct adlink_evdev *ed;
+	const char *label;
+	size_t size;
+	int ret;
+
+	ed = kzalloc(sizeof(*ed), GFP_KERNEL);
+	if (!ed)
+		return ERR_PTR(-ENOMEM);
+
+	kref_init(&ed->ref);
+	mutex_init(&ed->read_lock);
+	init_waitqueue_head(&ed->wait);
+	init_irq_work(&ed->wake_work, adlink_evdev_wake);
+
+	ed->nr_records = roundup_pow_of_two(max(ring_records, 2U));
+	ed->watermark = clamp(wakeup_watermark, 1U, ed->nr_records);
+
+	// Header gets the first page so that records start page aligned
+	size = PAGE_ALIGN(PAGE_SIZE + ed->nr_records * sizeof(struct adlink_gpio_event));
+	ed->ring = vmalloc_user(size);
+	if (!ed->ring) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+
+	ed->ring->version = ADLINK_GPIO_RING_VERSION;
+	ed->ring->record_size = sizeof(struct adlink_gpio_event);
+	ed->ring->nr_records = ed->nr_records;
+	ed->ring->data_offset = PAGE_SIZE;
+	ed->records = (void *)ed->ring + PAGE_SIZE;
+
+	if (device_property_read_string(dev, "label", &label))
+		label = dev_name(dev);
+
+	ed->miscdev.name = kasprintf(GFP_KERNEL, "%s-%s", prefix, label);
+	if (!ed->miscdev.name) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+	ed->miscdev.minor = MISC_DYNAMIC_MINOR;
+	ed->miscdev.fops = &adlink_evdev_fops;
+	ed->miscdev.parent = dev;
+	ed->miscdev.groups = adlink_evdev_groups;
+
+	ret = misc_register(&ed->miscdev);
+	if (ret)
+		goto err_free;
+
+	ret = devm_add_action_or_reset(dev, adlink_evdev_unregister, ed);
+	if (ret)
+		return ERR_PTR(ret);
+
+	dev_info(dev, "events on /dev/%s, %u records\n", ed->miscdev.name,
+		 ed->nr_records);
+
+	return ed;
+
+err_free:
+	adlink_evdev_free(&ed->ref);
+	return ERR_PTR(ret);
+}
+EXPORT_SYMBOL_GPL(devm_adlink_evdev_create);
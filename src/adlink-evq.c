@@ -0,0 +1,141 @@
+/*
+ * adlink-evq.c -- lossless hard IRQ to thread handoff of edge events
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/device.h>
+#include <linux/slab.h>
+#include <linux/log2.h>
+#include <linux/atomic.h>
+
+#include "adlink-gpio-event.h"
+#include "adlink-lib.h"
+#include "adlink-lib-priv.h"
+
+#define ADLINK_EVQ_MIN_EVENTS	16
+
+struct adlink_evq {
+	struct adlink_gpio_event *events;
+	u32 mask;			/* size - 1, size is a power of two */
+
+	/* Producer side */
+	u64 head;			/* published with release */
+	bool lost;			/* flag the next event with ADLINK_GPIO_EVENT_OVERRUN */
+	u64 dropped;
+	u64 max_depth;
+
+	/* Consumer side */
+	u64 tail;			/* published with release */
+	bool in_run;			/* popped since the queue was last found empty */
+	u64 delivered;
+	u64 coalesced;
+};
+
+static void adlink_evq_devres_release(struct device *dev, void *res)
+{
+}
+
+static struct adlink_evq *to_adlink_evq(struct device *dev)
+{
+	return devres_find(dev, adlink_evq_devres_release, NULL, NULL);
+}
+
+bool adlink_evq_push(struct adlink_evq *q, const struct adlink_gpio_event *ev)
+{
+	u64 head = q->head;
+	u64 depth = head - smp_load_acquire(&q->tail);
+	struct adlink_gpio_event *slot;
+
+	if (depth > q->mask) {
+		WRITE_ONCE(q->dropped, q->dropped + 1);
+		q->lost = true;
+		return false;
+	}
+
+	slot = &q->events[head & q->mask];
+	*slot = *ev;
+	if (q->lost) {
+		slot->flags |= ADLINK_GPIO_EVENT_OVERRUN;
+		q->lost = false;
+	}
+	if (depth + 1 > q->max_depth)
+		WRITE_ONCE(q->max_depth, depth + 1);
+
+	// The slot is complete before the consumer can see it
+	smp_store_release(&q->head, head + 1);
+
+	return true;
+}
+EXPORT_SYMBOL_GPL(adlink_evq_push);
+
+bool adlink_evq_pop(struct adlink_evq *q, struct adlink_gpio_event *ev)
+{
+	u64 tail = q->tail;
+
+	if (smp_load_acquire(&q->head) == tail) {
+		q->in_run = false;
+		return false;
+	}
+
+	*ev = q->events[tail & q->mask];
+	// Done with the slot before the producer may reuse it
+	smp_store_release(&q->tail, tail + 1);
+
+	WRITE_ONCE(q->delivered, q->delivered + 1);
+	if (q->in_run)
+		WRITE_ONCE(q->coalesced, q->coalesced + 1);
+	q->in_run = true;
+
+	return true;
+}
+EXPORT_SYMBOL_GPL(adlink_evq_pop);
+
+/* "<delivered> <dropped> <coalesced> <max depth>/<size>" */
+static ssize_t handoff_show(struct device *dev,
+			    struct device_attribute *attr, char *buf)
+{
+	struct adlink_evq *q = to_adlink_evq(dev);
+
+	return sprintf(buf, "%llu %llu %llu %llu/%u\n", READ_ONCE(q->delivered),
+		       READ_ONCE(q->dropped), READ_ONCE(q->coalesced),
+		       READ_ONCE(q->max_depth), q->mask + 1);
+}
+static DEVICE_ATTR_RO(handoff);
+
+static struct attribute *adlink_evq_attrs[] = {
+	&dev_attr_handoff.attr,
+	NULL,
+};
+
+static const struct attribute_group adlink_evq_group = {
+	.attrs = adlink_evq_attrs,
+};
+
+struct adlink_evq *devm_adlink_evq_create(struct device *dev, unsigned int events)
+{
+	struct adlink_evq *q;
+	int ret;
+
+	q = devres_alloc(adlink_evq_devres_release, sizeof(*q), GFP_KERNEL);
+	if (!q)
+		return ERR_PTR(-ENOMEM);
+	devres_add(dev, q);
+
+	events = roundup_pow_of_two(max_t(unsigned int, events, ADLINK_EVQ_MIN_EVENTS));
+	q->events = devm_kcalloc(dev, events, sizeof(*q->events), GFP_KERNEL);
+	if (!q->events)
+		return ERR_PTR(-ENOMEM);
+	q->mask = events - 1;
+
+	ret = devm_device_add_group(dev, &adlink_evq_group);
+	if (ret)
+		return ERR_PTR(ret);
+
+	return q;
+}
+EXPORT_SYMBOL_GPL(devm_adlink_evq_create);
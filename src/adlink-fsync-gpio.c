@@ -2,63 +2,255 @@
 #include <linux/interrupt.h>
 #include <linux/module.h>
 #include <linux/platform_device.h>
+#include <linux/kthread.h>
+#include <linux/hrtimer.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+
+#include "adlink-gpio-event.h"
+#include "adlink-gte.h"
+#include "adlink-lib.h"
+#include "adlink-trace.h"
 
 #define DRIVER_NAME "adlink-fsync-gpio"
+#define FSYNC_MAX_CHANNELS 32
+#define FSYNC_HANDOFF_MIN 64	// events the log thread may fall behind by
+#define FSYNC_COALESCE_MAX 4096
+#define FSYNC_COALESCE_TIMEOUT_MAX_US 1000000
 
-struct fsync_gpio_device_data {
+struct fsync_gpio_device_data;
+
+// One dser pin of the device
+struct fsync_gpio_channel {
+	struct fsync_gpio_device_data *priv;
+	unsigned int index;
 	int irq;
-	struct gpio_desc *fsync_gpio_desc;
+	struct gpio_desc *desc;
+	struct adlink_gte gte;
+};
+
+struct fsync_gpio_device_data {
+	struct device *dev;
+	struct gpio_descs *fsync_gpios;
+	struct fsync_gpio_channel *channels;
+	unsigned int nr_channels;
 	bool assert_falling_edge;
-	bool base_gpio;
-	time64_t time;
-	u64 nsec;
+	struct adlink_irqstat *irqstat;
+	struct adlink_irqaff *irqaff;	// hard IRQs and the log thread
+
+	/* All channels share one log thread, woken once per batch of edges */
+	struct kthread_worker *worker;
+	struct kthread_work log_work;
+	struct adlink_evq *handoff;	// every edge, pushed under ring_lock
+	u64 wakeups;		// log_work runs
+
+	/*
+	 * Coalescing, the hard IRQ only wakes the log thread and flushes the
+	 * event device once per coalesce_events edges, or coalesce_timeout_us
+	 * after the first edge of an incomplete batch (0: no timeout)
+	 */
+	u32 coalesce_events;
+	u32 coalesce_timeout_us;
+	u32 batched;		// edges since the last wakeup, under ring_lock
+	struct hrtimer coalesce_timer;
+
+	/* Timestamps for userspace, one stream for all channels */
+	struct adlink_evdev *evdev;
+	raw_spinlock_t ring_lock;	// serializes the per-channel IRQs
 };
 
+// Hand a batch of edges to the log thread and to the readers
+static void fsync_wake(struct fsync_gpio_device_data *priv)
+{
+	// Coalesces with a wakeup that is still pending
+	kthread_queue_work(priv->worker, &priv->log_work);
+	adlink_evdev_flush(priv->evdev);
+}
+
+// The batch did not complete within coalesce_timeout_us
+static enum hrtimer_restart fsync_coalesce_timeout(struct hrtimer *timer)
+{
+	struct fsync_gpio_device_data *priv = container_of(timer,
+			struct fsync_gpio_device_data, coalesce_timer);
+	unsigned long irq_flags;
+
+	raw_spin_lock_irqsave(&priv->ring_lock, irq_flags);
+	priv->batched = 0;
+	raw_spin_unlock_irqrestore(&priv->ring_lock, irq_flags);
+
+	fsync_wake(priv);
+
+	return HRTIMER_NORESTART;
+}
+
+// Timestamp one edge of @ch and queue it, runs in hard IRQ context
+static void fsync_capture(struct fsync_gpio_channel *ch)
+{
+	struct fsync_gpio_device_data *priv = ch->priv;
+	unsigned long irq_flags;
+	bool wake;
+	struct adlink_gpio_event ev = {
+		.flags = priv->assert_falling_edge ? ADLINK_GPIO_EVENT_FALLING : 0,
+		.channel = ch->index,
+	};
+	s64 age;
+
+	adlink_irqstat_hardirq(priv->irqstat);
+
+	// Stamp under the lock, so that the shared ring stays in time order
+	raw_spin_lock_irqsave(&priv->ring_lock, irq_flags);
+	adlink_event_clocks(&ev);
+	// Prefer the GTE stamp, it does not include the IRQ entry latency
+	age = adlink_gte_edge_age(&ch->gte, &ev.raw);
+	if (age >= 0) {
+		adlink_event_backdate(&ev, age);
+		ev.flags |= ADLINK_GPIO_EVENT_HWTS;
+	}
+	ev.seq = adlink_evdev_push_event(priv->evdev, &ev);
+	// The lock makes the channel IRQs a single producer
+	adlink_evq_push(priv->handoff, &ev);
+
+	wake = ++priv->batched >= READ_ONCE(priv->coalesce_events);
+	if (wake) {
+		priv->batched = 0;
+		hrtimer_try_to_cancel(&priv->coalesce_timer);
+	} else if (priv->batched == 1 && READ_ONCE(priv->coalesce_timeout_us)) {
+		hrtimer_start(&priv->coalesce_timer,
+			      us_to_ktime(READ_ONCE(priv->coalesce_timeout_us)),
+			      HRTIMER_MODE_REL_HARD);
+	}
+	raw_spin_unlock_irqrestore(&priv->ring_lock, irq_flags);
+
+	trace_adlink_gpio_edge(ch->irq, ch->index, ev.seq, ev.ns, ev.raw, ev.flags);
+	if (wake)
+		fsync_wake(priv);
+}
+
 // Top ISR, deal with the real-time tasks
 static irqreturn_t _irq_top_handler(int irq, void *data)
 {
-	// Get the time stamp
-	struct fsync_gpio_device_data *priv = data;
+	fsync_capture(data);
 
-	priv->nsec = ktime_get_real_ns();
-	priv->time = ktime_get_real_seconds();
-		
-	return IRQ_WAKE_THREAD; // schedule the bottom half
+	return IRQ_HANDLED;
 }
 
-// Bottom ISR, run the remain tasks after Top ISR
-static irqreturn_t _irq_bottom_handler(int irq, void *data)
+// Nested ISR of base-gpio, there is no hard IRQ context on PCA953x
+static irqreturn_t _irq_nested_handler(int irq, void *data)
 {
-	struct fsync_gpio_device_data *priv = data;
-    unsigned int ms, sec, min, hour;
-    u64 nsec = priv->nsec % (u64) 1e9;
-
-	// TODO: Consider to use spin_lock here
-	// ms = (priv->nsec / 1000000) % 1000;
-	sec = priv->time % 60;
-	min = (priv->time / 60) % 60;
-	hour = (priv->time / 3600) % 24 + (sys_tz.tz_minuteswest / 60);
-	printk("bottom-irq=%d, %02u:%02u:%02u.%09llu", irq, hour, min, sec, nsec);
+	fsync_capture(data);
 
 	return IRQ_HANDLED;
 }
 
+// Bottom half shared by all channels, reports every edge queued since the last run
+static void fsync_log_work(struct kthread_work *work)
+{
+	struct fsync_gpio_device_data *priv = container_of(work,
+			struct fsync_gpio_device_data, log_work);
+	u64 start = adlink_irqstat_thread_begin(priv->irqstat);
+	struct adlink_gpio_event ev;
+
+	adlink_irqaff_thread(priv->irqaff);
+
+	while (adlink_evq_pop(priv->handoff, &ev)) {
+		if (ev.flags & ADLINK_GPIO_EVENT_OVERRUN)
+			dev_warn_ratelimited(priv->dev, "log thread fell behind, edges before seq %llu lost\n",
+					     ev.seq);
+		trace_adlink_gpio_thread(priv->channels[ev.channel].irq, ev.channel,
+					 ev.seq, ev.ns);
+	}
+	WRITE_ONCE(priv->wakeups, priv->wakeups + 1);
+
+	adlink_irqstat_thread_end(priv->irqstat, start);
+}
+
 static int fsync_gpio_setup(struct device *dev)
 {
 	struct fsync_gpio_device_data *priv = dev_get_drvdata(dev);
+	unsigned int i;
+	int ret;
 
 	priv->assert_falling_edge =
 		device_property_read_bool(dev, "assert-falling-edge");
+
+	// Defaults to one wakeup per edge
+	priv->coalesce_events = 1;
+	device_property_read_u32(dev, "coalesce-events", &priv->coalesce_events);
+	device_property_read_u32(dev, "coalesce-timeout-us", &priv->coalesce_timeout_us);
+	if (!priv->coalesce_events || priv->coalesce_events > FSYNC_COALESCE_MAX ||
+	    priv->coalesce_timeout_us > FSYNC_COALESCE_TIMEOUT_MAX_US) {
+		dev_err(dev, "invalid coalesce-events %u or coalesce-timeout-us %u\n",
+			priv->coalesce_events, priv->coalesce_timeout_us);
+		return -EINVAL;
+	}
 		
-	priv->fsync_gpio_desc = devm_gpiod_get(dev, "dser", GPIOD_IN);
-	if (IS_ERR(priv->fsync_gpio_desc)) {
-		return dev_err_probe(dev, PTR_ERR(priv->fsync_gpio_desc),
+	priv->fsync_gpios = devm_gpiod_get_array(dev, "dser", GPIOD_IN);
+	if (IS_ERR(priv->fsync_gpios)) {
+		return dev_err_probe(dev, PTR_ERR(priv->fsync_gpios),
 				     "failed to request dser-gpios");
 	}
 
+	priv->nr_channels = priv->fsync_gpios->ndescs;
+	if (priv->nr_channels > FSYNC_MAX_CHANNELS) {
+		dev_err(dev, "%u dser-gpios, at most %u are supported\n",
+			priv->nr_channels, FSYNC_MAX_CHANNELS);
+		return -EINVAL;
+	}
+
+	priv->channels = devm_kcalloc(dev, priv->nr_channels,
+				      sizeof(*priv->channels), GFP_KERNEL);
+	if (!priv->channels)
+		return -ENOMEM;
+
+	for (i = 0; i < priv->nr_channels; i++) {
+		struct fsync_gpio_channel *ch = &priv->channels[i];
+
+		ch->priv = priv;
+		ch->index = i;
+		ch->desc = priv->fsync_gpios->desc[i];
+		ret = adlink_gte_setup(dev, &ch->gte, ch->desc);
+		if (ret)
+			return ret;
+	}
+
 	return 0;
 }
 
+static void fsync_worker_destroy(void *data)
+{
+	struct fsync_gpio_device_data *priv = data;
+
+	// The IRQs are gone, so nothing restarts the timer. The evdev it flushes
+	// was created before the worker and is only released after this.
+	hrtimer_cancel(&priv->coalesce_timer);
+	kthread_destroy_worker(priv->worker);
+}
+
+// Must be called after the evdev is created and before the IRQs are requested,
+// so it is torn down after the IRQs and before the evdev
+static int fsync_worker_setup(struct device *dev)
+{
+	struct fsync_gpio_device_data *priv = dev_get_drvdata(dev);
+
+	// Room for two full batches of every channel
+	priv->handoff = devm_adlink_evq_create(dev, max(2 * priv->nr_channels * priv->coalesce_events,
+							(u32)FSYNC_HANDOFF_MIN));
+	if (IS_ERR(priv->handoff))
+		return PTR_ERR(priv->handoff);
+
+	kthread_init_work(&priv->log_work, fsync_log_work);
+	hrtimer_init(&priv->coalesce_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_HARD);
+	priv->coalesce_timer.function = fsync_coalesce_timeout;
+	priv->worker = kthread_create_worker(0, "irq/%s", dev_name(dev));
+	if (IS_ERR(priv->worker))
+		return PTR_ERR(priv->worker);
+
+	// Same priority as the IRQ threads it replaces
+	sched_set_fifo(priv->worker->task);
+
+	return devm_add_action_or_reset(dev, fsync_worker_destroy, priv);
+}
+
 static unsigned long
 get_irqf_trigger_flags(const struct fsync_gpio_device_data *priv)
 {
@@ -72,6 +264,8 @@ static int fsync_gpio_probe(struct platform_device *pdev)
 {
 	struct fsync_gpio_device_data *priv;
 	struct device *dev = &(pdev->dev);
+	unsigned int i;
+	bool nested;
 	int ret;
 
 	/* allocate space for device info */
@@ -80,6 +274,8 @@ static int fsync_gpio_probe(struct platform_device *pdev)
 		return -ENOMEM;
 
 	dev_set_drvdata(dev, priv);
+	priv->dev = dev;
+	raw_spin_lock_init(&priv->ring_lock);
 
 	/* GPIO setup */
 	ret = fsync_gpio_setup(dev);
@@ -88,28 +284,70 @@ static int fsync_gpio_probe(struct platform_device *pdev)
 		return ret;
     }
 
-	/* IRQ setup */
-	ret = gpiod_to_irq(priv->fsync_gpio_desc);
-	if (ret < 0) {
-		dev_err(dev, "failed to map GPIO to IRQ: %d\n", ret);
-		return -EINVAL;
+	/* Latency instrumentation */
+	priv->irqstat = devm_adlink_irqstat_create(dev);
+	if (IS_ERR(priv->irqstat)) {
+		dev_err(dev, "failed to create IRQ statistics\n");
+		return PTR_ERR(priv->irqstat);
+	}
+
+	/* IRQ CPU and thread priority */
+	priv->irqaff = devm_adlink_irqaff_create(dev);
+	if (IS_ERR(priv->irqaff)) {
+		dev_err(dev, "failed to set up IRQ affinity\n");
+		return PTR_ERR(priv->irqaff);
 	}
-	priv->irq = ret;
-
-	if (priv->base_gpio) {		
-		// base-gpio doesn't need an IRQ Top handler because the interrupt occurs on PCA953x
-		ret = devm_request_threaded_irq(dev, priv->irq, NULL, _irq_bottom_handler,
-			get_irqf_trigger_flags(priv), DRIVER_NAME, priv);
-	} else {
-		ret = devm_request_threaded_irq(dev, priv->irq, _irq_top_handler, _irq_bottom_handler,
-			get_irqf_trigger_flags(priv), DRIVER_NAME, priv);
+
+	/* Event device setup, before the worker whose timer flushes it */
+	priv->evdev = devm_adlink_evdev_create(dev, "adlink-fsync");
+	if (IS_ERR(priv->evdev)) {
+		dev_err(dev, "failed to create event device\n");
+		return PTR_ERR(priv->evdev);
 	}
+
+	/* Bottom half setup */
+	ret = fsync_worker_setup(dev);
 	if (ret) {
-		dev_err(dev, "failed to acquire IRQ %d, ret=%d\n", priv->irq, ret);
-		return -EINVAL;
+		dev_err(dev, "failed to create worker: %d\n", ret);
+		return ret;
 	}
 
-	dev_info(dev, "Driver %s has been successfully probed\n", DRIVER_NAME);
+	/* IRQ setup, one per channel */
+	for (i = 0; i < priv->nr_channels; i++) {
+		struct fsync_gpio_channel *ch = &priv->channels[i];
+
+		ret = gpiod_to_irq(ch->desc);
+		if (ret < 0) {
+			dev_err(dev, "failed to map GPIO to IRQ: %d\n", ret);
+			return -EINVAL;
+		}
+		ch->irq = ret;
+
+		// Pins on the PCA953x of base-gpio sleep, their IRQs are nested in its IRQ thread
+		nested = gpiod_cansleep(ch->desc);
+		if (nested) {
+			// base-gpio doesn't need an IRQ Top handler because the interrupt occurs on PCA953x
+			ret = devm_request_threaded_irq(dev, ch->irq, NULL, _irq_nested_handler,
+				get_irqf_trigger_flags(priv) | IRQF_ONESHOT, DRIVER_NAME, ch);
+		} else {
+			ret = devm_request_irq(dev, ch->irq, _irq_top_handler,
+				get_irqf_trigger_flags(priv), DRIVER_NAME, ch);
+		}
+		if (ret) {
+			dev_err(dev, "failed to acquire IRQ %d, ret=%d\n", ch->irq, ret);
+			return -EINVAL;
+		}
+
+		// Nested IRQs of base-gpio have no affinity of their own
+		if (!nested) {
+			ret = devm_adlink_irqaff_add_irq(dev, priv->irqaff, ch->irq);
+			if (ret)
+				return ret;
+		}
+	}
+
+	dev_info(dev, "Driver %s has been successfully probed, %u channels, wakeup per %u edges or %u us\n",
+		 DRIVER_NAME, priv->nr_channels, priv->coalesce_events, priv->coalesce_timeout_us);
 
 	return 0;
 }
@@ -118,11 +356,86 @@ static int fsync_gpio_remove(struct platform_device *pdev)
 {
 	struct fsync_gpio_device_data *priv = platform_get_drvdata(pdev);
 
-	dev_info(&pdev->dev, "removed IRQ %d\n", priv->irq);
+	dev_info(&pdev->dev, "removed %u channels, %llu overruns\n",
+		 priv->nr_channels, adlink_evdev_overruns(priv->evdev));
 
 	return 0;
 }
 
+static ssize_t coalesce_events_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	struct fsync_gpio_device_data *priv = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", READ_ONCE(priv->coalesce_events));
+}
+
+static ssize_t coalesce_events_store(struct device *dev,
+				     struct device_attribute *attr,
+				     const char *buf, size_t count)
+{
+	struct fsync_gpio_device_data *priv = dev_get_drvdata(dev);
+	u32 val;
+	int ret;
+
+	ret = kstrtou32(buf, 0, &val);
+	if (ret)
+		return ret;
+	if (!val || val > FSYNC_COALESCE_MAX)
+		return -EINVAL;
+
+	// A partial batch is completed by the next edge or the timeout
+	WRITE_ONCE(priv->coalesce_events, val);
+
+	return count;
+}
+static DEVICE_ATTR_RW(coalesce_events);
+
+static ssize_t coalesce_timeout_us_show(struct device *dev,
+					struct device_attribute *attr, char *buf)
+{
+	struct fsync_gpio_device_data *priv = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", READ_ONCE(priv->coalesce_timeout_us));
+}
+
+static ssize_t coalesce_timeout_us_store(struct device *dev,
+					 struct device_attribute *attr,
+					 const char *buf, size_t count)
+{
+	struct fsync_gpio_device_data *priv = dev_get_drvdata(dev);
+	u32 val;
+	int ret;
+
+	ret = kstrtou32(buf, 0, &val);
+	if (ret)
+		return ret;
+	if (val > FSYNC_COALESCE_TIMEOUT_MAX_US)
+		return -EINVAL;
+
+	WRITE_ONCE(priv->coalesce_timeout_us, val);
+
+	return count;
+}
+static DEVICE_ATTR_RW(coalesce_timeout_us);
+
+static ssize_t thread_wakeups_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct fsync_gpio_device_data *priv = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%llu\n", READ_ONCE(priv->wakeups));
+}
+static DEVICE_ATTR_RO(thread_wakeups);
+
+static struct attribute *fsync_gpio_attrs[] = {
+	&dev_attr_coalesce_events.attr,
+	&dev_attr_coalesce_timeout_us.attr,
+	&dev_attr_thread_wakeups.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(fsync_gpio);
+
 static const struct of_device_id fsync_gpio_dt_ids[] = {
 	{ .compatible = DRIVER_NAME, },
 	{ /* sentinel */ }
@@ -135,6 +448,7 @@ static struct platform_driver fsync_gpio_driver = {
 	.driver		= {
 		.name	= DRIVER_NAME,
 		.of_match_table	= fsync_gpio_dt_ids,
+		.dev_groups	= fsync_gpio_groups,
 	},
 };
 
@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/*
+ * Userspace interface of the ADLINK GPIO capture drivers.
+ *
+ * Every captured edge is stored as a fixed-size struct adlink_gpio_event in
+ * a single-producer ring. The ring is consumed in one of two ways.
+ *
+ * read() copies as many whole records as fit into the buffer and releases
+ * them. It blocks until wakeup_watermark records are pending, unless the
+ * file is O_NONBLOCK. poll() reports EPOLLIN at the same watermark.
+ *
+ * The ring can also be mmap()ed read-only: the first page holds struct
+ * adlink_gpio_ring_header and the records start at data_offset.
+ *
+ * Consumer loop:
+ *
+ *	head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+ *	for (; tail != head; tail++)
+ *		handle(&rec[tail & (hdr->nr_records - 1)]);
+ *	ioctl(fd, ADLINK_GPIO_IOC_RELEASE, &tail);
+ *
+ * The kernel never overwrites records that have not been released. When the
+ * ring is full new edges are dropped, counted in overruns, and the next
+ * stored record carries ADLINK_GPIO_EVENT_OVERRUN. Sequence numbers keep
+ * counting across dropped edges, so the gap tells how many were lost.
+ *
+ * A device with several pins stores the edges of all of them in one ring,
+ * ordered by the time the kernel took the stamp and tagged with channel.
+ */
+
+#ifndef _ADLINK_GPIO_EVENT_H
+#define _ADLINK_GPIO_EVENT_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define ADLINK_GPIO_RING_VERSION	5
+
+/* Event flags */
+#define ADLINK_GPIO_EVENT_FALLING	(1 << 0)	/* captured on a falling edge */
+#define ADLINK_GPIO_EVENT_OVERRUN	(1 << 1)	/* edges were dropped before this one */
+#define ADLINK_GPIO_EVENT_HWTS		(1 << 2)	/* ns comes from a GTE hardware stamp */
+
+struct adlink_gpio_event {
+	__u64 seq;		/* edge sequence number, starts at 0 */
+	__u64 ns;		/* CLOCK_REALTIME in ns */
+	__u64 raw;		/* GTE TSC count of the edge, 0 for software stamps */
+	__u32 flags;		/* ADLINK_GPIO_EVENT_* */
+	__u32 channel;		/* index of the pin in the device's GPIO array */
+	/*
+	 * The other clocks at the same instant, 0 if the driver does not take
+	 * them. The capture drivers take all of them from one clock read.
+	 */
+	__u64 mono_ns;		/* CLOCK_MONOTONIC in ns */
+	__u64 mono_raw_ns;	/* CLOCK_MONOTONIC_RAW in ns */
+	__u64 boot_ns;		/* CLOCK_BOOTTIME in ns */
+	__u64 tai_ns;		/* CLOCK_TAI in ns */
+};
+
+struct adlink_gpio_ring_header {
+	__u32 version;		/* ADLINK_GPIO_RING_VERSION */
+	__u32 record_size;	/* sizeof(struct adlink_gpio_event) */
+	__u32 nr_records;	/* always a power of two */
+	__u32 data_offset;	/* offset of record 0 in the mapping */
+	__u64 head;		/* records produced, updated with release semantics */
+	__u64 tail;		/* records released by the consumer */
+	__u64 overruns;		/* edges dropped because the ring was full */
+};
+
+#define ADLINK_GPIO_IOC_MAGIC		0xad
+
+/* Release all records before the given ring position (a __u64 head value) */
+#define ADLINK_GPIO_IOC_RELEASE		_IOW(ADLINK_GPIO_IOC_MAGIC, 1, __u64)
+
+#endif /* _ADLINK_GPIO_EVENT_H */
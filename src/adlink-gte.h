@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Optional GTE (Generic Timestamp Engine) edge capture for the ADLINK GPIO
+ * drivers, selected per DT node with the "gte-timestamp" property.
+ *
+ * GTE latches the TSC when the edge happens, so the stamp carries no IRQ
+ * entry latency. The TSC also drives the Arm system counter, which lets the
+ * top half date the edge in its own clock: take the counter in the same read
+ * as the software timestamp and subtract the age of the GTE stamp from it.
+ *
+ * GTE only monitors AON GPIOs. Any other pin, or a kernel without GTE,
+ * keeps the hard IRQ software timestamp.
+ */
+
+#ifndef _ADLINK_GTE_H
+#define _ADLINK_GTE_H
+
+#include <linux/device.h>
+#include <linux/gpio/consumer.h>
+#include <linux/of.h>
+#include <linux/math64.h>
+
+#if IS_ENABLED(CONFIG_TEGRA_HTS_GTE) && defined(CONFIG_ARM64)
+#include <linux/tegra-gte.h>
+#include <asm/arch_timer.h>
+#define ADLINK_HAVE_GTE 1
+#endif
+
+/* Stamps older than this belong to an edge we did not get an IRQ for */
+#define ADLINK_GTE_MAX_AGE_NS	NSEC_PER_SEC
+
+struct adlink_gte {
+#ifdef ADLINK_HAVE_GTE
+	struct tegra_gte_ev_desc *ev;
+	u32 rate;			/* TSC frequency in Hz */
+	u64 max_age;			/* ADLINK_GTE_MAX_AGE_NS in TSC ticks */
+#endif
+	bool enabled;
+};
+
+#ifdef ADLINK_HAVE_GTE
+static inline void adlink_gte_release(void *data)
+{
+	struct adlink_gte *gte = data;
+
+	tegra_gte_unregister_event(gte->ev);
+}
+
+static inline int adlink_gte_setup(struct device *dev, struct adlink_gte *gte,
+				   struct gpio_desc *desc)
+{
+	struct device_node *np;
+
+	if (!device_property_read_bool(dev, "gte-timestamp"))
+		return 0;
+
+	np = of_find_compatible_node(NULL, NULL, "nvidia,tegra194-gte-aon");
+	if (!np)
+		np = of_find_compatible_node(NULL, NULL, "nvidia,tegra234-gte-aon");
+	if (!np) {
+		dev_info(dev, "no AON GTE, using software timestamps\n");
+		return 0;
+	}
+
+	gte->ev = tegra_gte_register_event(np, desc_to_gpio(desc));
+	of_node_put(np);
+	if (IS_ERR(gte->ev)) {
+		dev_info(dev, "GPIO %d is not monitored by GTE, using software timestamps\n",
+			 desc_to_gpio(desc));
+		gte->ev = NULL;
+		return 0;
+	}
+
+	gte->rate = arch_timer_get_rate();
+	gte->max_age = div_u64((u64)gte->rate * ADLINK_GTE_MAX_AGE_NS, NSEC_PER_SEC);
+	gte->enabled = true;
+	dev_info(dev, "using GTE hardware timestamps\n");
+
+	// Registered before the IRQ so that it is released after the IRQ is freed
+	return devm_add_action_or_reset(dev, adlink_gte_release, gte);
+}
+
+/*
+ * Called from the top half after adlink_event_clocks(), @raw holds the
+ * clocksource count of the software timestamp, which is the arch counter on
+ * Tegra. Returns how long before it the edge happened in ns and replaces
+ * @raw by the TSC of the edge, or returns -1 and clears @raw if no fresh GTE
+ * stamp is available.
+ */
+static inline s64 adlink_gte_edge_age(struct adlink_gte *gte, u64 *raw)
+{
+	struct tegra_gte_ev_detail hts;
+	u64 now = *raw;
+
+	*raw = 0;
+	if (!gte->enabled || tegra_gte_retrieve_event(gte->ev, &hts))
+		return -1;
+
+	if (now < hts.ts_raw || now - hts.ts_raw > gte->max_age)
+		return -1;
+
+	*raw = hts.ts_raw;
+	return div_u64((now - hts.ts_raw) * NSEC_PER_SEC, gte->rate);
+}
+#else
+static inline int adlink_gte_setup(struct device *dev, struct adlink_gte *gte,
+				   struct gpio_desc *desc)
+{
+	if (device_property_read_bool(dev, "gte-timestamp"))
+		dev_info(dev, "kernel without GTE support, using software timestamps\n");
+
+	return 0;
+}
+
+static inline s64 adlink_gte_edge_age(struct adlink_gte *gte, u64 *raw)
+{
+	*raw = 0;
+	return -1;
+}
+#endif
+
+#endif /* _ADLINK_GTE_H */
@@ -0,0 +1,332 @@
+/*
+ * adlink-irqaff.c -- IRQ CPU affinity and IRQ thread scheduling per device
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/device.h>
+#include <linux/interrupt.h>
+#include <linux/irq.h>
+#include <linux/cpumask.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <uapi/linux/sched/types.h>
+
+#include "adlink-lib.h"
+#include "adlink-lib-priv.h"
+
+#define ADLINK_IRQAFF_MAX_IRQS	32
+
+struct adlink_irqaff {
+	struct device *dev;
+	struct mutex lock;		/* serializes mask and irqs updates */
+	struct cpumask mask;		/* hard IRQ affinity, empty: left alone */
+	int irqs[ADLINK_IRQAFF_MAX_IRQS];
+	unsigned int nr_irqs;
+
+	/* Read by the IRQ thread on every run */
+	int thread_cpu;			/* -1: follow the hard IRQ */
+	u32 thread_priority;		/* SCHED_FIFO priority, 0: kernel default */
+	bool thread_priority_owned;	/* the thread runs at a priority we set */
+
+	/* What the thread applied last, reported in irq_thread */
+	pid_t thread_pid;
+	int thread_applied_cpu;
+	u32 thread_applied_priority;
+};
+
+/* One IRQ of the device, its affinity hint is dropped before it is freed */
+struct adlink_irqaff_irq {
+	struct adlink_irqaff *af;
+	int irq;
+};
+
+static void adlink_irqaff_devres_release(struct device *dev, void *res)
+{
+}
+
+static struct adlink_irqaff *to_adlink_irqaff(struct device *dev)
+{
+	return devres_find(dev, adlink_irqaff_devres_release, NULL, NULL);
+}
+
+// Caller holds af->lock
+static int adlink_irqaff_set_irqs(struct adlink_irqaff *af)
+{
+	unsigned int i;
+	int ret;
+
+	if (cpumask_empty(&af->mask))
+		return 0;
+
+	for (i = 0; i < af->nr_irqs; i++) {
+		ret = irq_set_affinity_hint(af->irqs[i], &af->mask);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static void adlink_irqaff_release_irq(void *data)
+{
+	struct adlink_irqaff_irq *hint = data;
+	struct adlink_irqaff *af = hint->af;
+
+	// IRQs are freed in reverse order, stop touching any of them from sysfs
+	mutex_lock(&af->lock);
+	af->nr_irqs = 0;
+	mutex_unlock(&af->lock);
+
+	// free_irq() insists on the hint being gone
+	irq_set_affinity_hint(hint->irq, NULL);
+}
+
+void adlink_irqaff_thread(struct adlink_irqaff *af)
+{
+	struct sched_attr attr = { .size = sizeof(attr) };
+	int cpu, prio, fifo;
+
+	if (IS_ERR_OR_NULL(af))
+		return;
+
+	// The IRQ core moves the thread along with the hard IRQ, so check every run
+	cpu = READ_ONCE(af->thread_cpu);
+	if (cpu >= 0 && cpu_online(cpu) &&
+	    !cpumask_equal(current->cpus_ptr, cpumask_of(cpu)) &&
+	    !set_cpus_allowed_ptr(current, cpumask_of(cpu)))
+		dev_info(af->dev, "IRQ thread %d pinned to CPU %d\n", current->pid, cpu);
+
+	// 0 hands the thread back to the default of IRQ threads, SCHED_FIFO at MAX_RT_PRIO / 2
+	prio = READ_ONCE(af->thread_priority);
+	fifo = prio ? prio : MAX_RT_PRIO / 2;
+	if ((prio || af->thread_priority_owned) &&
+	    (current->policy != SCHED_FIFO || current->rt_priority != fifo)) {
+		// sched_setscheduler_nocheck() is no longer exported since 5.9
+		attr.sched_policy = SCHED_FIFO;
+		attr.sched_priority = fifo;
+		if (!sched_setattr_nocheck(current, &attr))
+			dev_info(af->dev, "IRQ thread %d at SCHED_FIFO %d\n", current->pid, fifo);
+	}
+	af->thread_priority_owned = prio;
+
+	WRITE_ONCE(af->thread_pid, current->pid);
+	WRITE_ONCE(af->thread_applied_cpu, cpumask_weight(current->cpus_ptr) == 1 ?
+		   cpumask_first(current->cpus_ptr) : -1);
+	WRITE_ONCE(af->thread_applied_priority,
+		   current->policy == SCHED_FIFO ? current->rt_priority : 0);
+}
+EXPORT_SYMBOL_GPL(adlink_irqaff_thread);
+
+int devm_adlink_irqaff_add_irq(struct device *dev, struct adlink_irqaff *af, int irq)
+{
+	struct adlink_irqaff_irq *hint;
+	int ret;
+
+	if (IS_ERR_OR_NULL(af))
+		return 0;
+
+	hint = devm_kzalloc(dev, sizeof(*hint), GFP_KERNEL);
+	if (!hint)
+		return -ENOMEM;
+	hint->af = af;
+	hint->irq = irq;
+
+	mutex_lock(&af->lock);
+	if (af->nr_irqs == ADLINK_IRQAFF_MAX_IRQS) {
+		mutex_unlock(&af->lock);
+		return -ENOSPC;
+	}
+	af->irqs[af->nr_irqs++] = irq;
+	ret = cpumask_empty(&af->mask) ? 0 : irq_set_affinity_hint(irq, &af->mask);
+	mutex_unlock(&af->lock);
+	if (ret)
+		dev_warn(dev, "failed to set affinity of IRQ %d to %*pbl: %d\n",
+			 irq, cpumask_pr_args(&af->mask), ret);
+
+	return devm_add_action_or_reset(dev, adlink_irqaff_release_irq, hint);
+}
+EXPORT_SYMBOL_GPL(devm_adlink_irqaff_add_irq);
+
+static ssize_t irq_affinity_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct adlink_irqaff *af = to_adlink_irqaff(dev);
+	const struct cpumask *mask = &af->mask;
+	struct irq_data *d;
+	ssize_t ret;
+
+	// Report what the IRQ really got, it may have been changed in /proc/irq
+	mutex_lock(&af->lock);
+	d = af->nr_irqs ? irq_get_irq_data(af->irqs[0]) : NULL;
+	if (d)
+		mask = irq_data_get_affinity_mask(d);
+	ret = sprintf(buf, "%*pbl\n", cpumask_pr_args(mask));
+	mutex_unlock(&af->lock);
+
+	return ret;
+}
+
+static ssize_t irq_affinity_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct adlink_irqaff *af = to_adlink_irqaff(dev);
+	cpumask_var_t mask;
+	int ret;
+
+	if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	ret = cpulist_parse(buf, mask);
+	if (!ret && !cpumask_intersects(mask, cpu_online_mask))
+		ret = -EINVAL;
+	if (!ret) {
+		mutex_lock(&af->lock);
+		cpumask_copy(&af->mask, mask);
+		ret = adlink_irqaff_set_irqs(af);
+		mutex_unlock(&af->lock);
+	}
+	free_cpumask_var(mask);
+
+	return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(irq_affinity);
+
+static ssize_t irq_thread_cpu_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct adlink_irqaff *af = to_adlink_irqaff(dev);
+
+	return sprintf(buf, "%d\n", READ_ONCE(af->thread_cpu));
+}
+
+/* -1 lets the thread follow the hard IRQ again, from its next run on */
+static ssize_t irq_thread_cpu_store(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t count)
+{
+	struct adlink_irqaff *af = to_adlink_irqaff(dev);
+	int val;
+	int ret;
+
+	ret = kstrtoint(buf, 0, &val);
+	if (ret)
+		return ret;
+	if (val < -1 || (val >= 0 && !cpu_possible(val)))
+		return -EINVAL;
+
+	WRITE_ONCE(af->thread_cpu, val);
+
+	return count;
+}
+static DEVICE_ATTR_RW(irq_thread_cpu);
+
+static ssize_t irq_thread_priority_show(struct device *dev,
+					struct device_attribute *attr, char *buf)
+{
+	struct adlink_irqaff *af = to_adlink_irqaff(dev);
+
+	return sprintf(buf, "%u\n", READ_ONCE(af->thread_priority));
+}
+
+static ssize_t irq_thread_priority_store(struct device *dev,
+					 struct device_attribute *attr,
+					 const char *buf, size_t count)
+{
+	struct adlink_irqaff *af = to_adlink_irqaff(dev);
+	u32 val;
+	int ret;
+
+	ret = kstrtou32(buf, 0, &val);
+	if (ret)
+		return ret;
+	if (val >= MAX_RT_PRIO)
+		return -EINVAL;
+
+	WRITE_ONCE(af->thread_priority, val);
+
+	return count;
+}
+static DEVICE_ATTR_RW(irq_thread_priority);
+
+/* "<pid> <cpu> <priority>" of the thread as of its last run, cpu -1: not pinned */
+static ssize_t irq_thread_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct adlink_irqaff *af = to_adlink_irqaff(dev);
+
+	return sprintf(buf, "%d %d %u\n", READ_ONCE(af->thread_pid),
+		       READ_ONCE(af->thread_applied_cpu),
+		       READ_ONCE(af->thread_applied_priority));
+}
+static DEVICE_ATTR_RO(irq_thread);
+
+static struct attribute *adlink_irqaff_attrs[] = {
+	&dev_attr_irq_affinity.attr,
+	&dev_attr_irq_thread_cpu.attr,
+	&dev_attr_irq_thread_priority.attr,
+	&dev_attr_irq_thread.attr,
+	NULL,
+};
+
+static const struct attribute_group adlink_irqaff_group = {
+	.attrs = adlink_irqaff_attrs,
+};
+
+/*
+ * Read "irq-affinity" (CPU list), "irq-thread-cpu" and "irq-thread-priority"
+ * of @dev and add the matching sysfs attributes. Must be called before the
+ * IRQs are requested, so that it is released only after they have been freed.
+ */
+struct adlink_irqaff *devm_adlink_irqaff_create(struct device *dev)
+{
+	struct adlink_irqaff *af;
+	u32 *cpus;
+	int nr_cpus, i, ret;
+
+	af = devres_alloc(adlink_irqaff_devres_release, sizeof(*af), GFP_KERNEL);
+	if (!af)
+		return ERR_PTR(-ENOMEM);
+
+	af->dev = dev;
+	mutex_init(&af->lock);
+	af->thread_cpu = -1;
+	af->thread_applied_cpu = -1;
+
+	nr_cpus = device_property_count_u32(dev, "irq-affinity");
+	cpus = nr_cpus > 0 ? kcalloc(nr_cpus, sizeof(*cpus), GFP_KERNEL) : NULL;
+	if (cpus && !device_property_read_u32_array(dev, "irq-affinity", cpus, nr_cpus)) {
+		for (i = 0; i < nr_cpus; i++) {
+			if (cpus[i] < nr_cpu_ids)
+				cpumask_set_cpu(cpus[i], &af->mask);
+		}
+	}
+	kfree(cpus);
+	device_property_read_u32(dev, "irq-thread-cpu", (u32 *)&af->thread_cpu);
+	device_property_read_u32(dev, "irq-thread-priority", &af->thread_priority);
+	if ((nr_cpus > 0 && !cpumask_intersects(&af->mask, cpu_online_mask)) ||
+	    af->thread_cpu < -1 || af->thread_cpu >= (int)nr_cpu_ids ||
+	    af->thread_priority >= MAX_RT_PRIO) {
+		dev_err(dev, "invalid irq-affinity, irq-thread-cpu or irq-thread-priority\n");
+		devres_free(af);
+		return ERR_PTR(-EINVAL);
+	}
+	devres_add(dev, af);
+
+	ret = devm_device_add_group(dev, &adlink_irqaff_group);
+	if (ret)
+		return ERR_PTR(ret);
+
+	if (!cpumask_empty(&af->mask) || af->thread_cpu >= 0 || af->thread_priority)
+		dev_info(dev, "IRQ affinity %*pbl, thread CPU %d, thread priority %u\n",
+			 cpumask_pr_args(&af->mask), af->thread_cpu, af->thread_priority);
+
+	return af;
+}
+EXPORT_SYMBOL_GPL(devm_adlink_irqaff_create);
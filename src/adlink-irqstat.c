@@ -0,0 +1,205 @@
+/*
+ * adlink-irqstat.c -- hard IRQ to thread latency histograms
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/device.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/percpu.h>
+#include <linux/atomic.h>
+#include <linux/log2.h>
+#include <linux/timekeeping.h>
+
+#include "adlink-lib.h"
+#include "adlink-lib-priv.h"
+
+/* Bucket n counts samples in [2^n, 2^(n+1)) ns, the last one is open ended */
+#define ADLINK_IRQSTAT_BUCKETS	32
+
+enum adlink_irqstat_metric {
+	ADLINK_IRQSTAT_WAKEUP,		/* hard IRQ entry -> thread start */
+	ADLINK_IRQSTAT_RUNTIME,		/* thread start -> thread end */
+	ADLINK_IRQSTAT_NR,
+};
+
+struct adlink_irqstat_hist {
+	u64 bucket[ADLINK_IRQSTAT_BUCKETS];
+	u64 count;
+	u64 sum;
+	u64 min;
+	u64 max;
+};
+
+struct adlink_irqstat {
+	struct adlink_irqstat_hist __percpu *hist;	/* [ADLINK_IRQSTAT_NR] per CPU */
+	atomic64_t hardirq_ns;		/* oldest hard IRQ not yet seen by the thread, 0 if none */
+	struct dentry *dir;
+};
+
+/* Thread context only: the per-CPU slot is owned while preemption is off */
+static void adlink_irqstat_record(struct adlink_irqstat *st,
+				  enum adlink_irqstat_metric metric, u64 ns)
+{
+	struct adlink_irqstat_hist *h = get_cpu_ptr(st->hist);
+
+	h += metric;
+	h->bucket[ns ? min_t(unsigned int, ilog2(ns), ADLINK_IRQSTAT_BUCKETS - 1) : 0]++;
+	if (!h->count || ns < h->min)
+		h->min = ns;
+	if (ns > h->max)
+		h->max = ns;
+	h->sum += ns;
+	h->count++;
+
+	put_cpu_ptr(st->hist);
+}
+
+void adlink_irqstat_hardirq(struct adlink_irqstat *st)
+{
+	if (IS_ERR_OR_NULL(st))
+		return;
+
+	// Keep the oldest pending edge, that is the one which waits longest
+	atomic64_cmpxchg(&st->hardirq_ns, 0, ktime_get_mono_fast_ns());
+}
+EXPORT_SYMBOL_GPL(adlink_irqstat_hardirq);
+
+u64 adlink_irqstat_thread_begin(struct adlink_irqstat *st)
+{
+	u64 now = ktime_get_mono_fast_ns();
+	u64 hardirq;
+
+	if (IS_ERR_OR_NULL(st))
+		return now;
+
+	hardirq = atomic64_xchg(&st->hardirq_ns, 0);
+	if (hardirq && now >= hardirq)
+		adlink_irqstat_record(st, ADLINK_IRQSTAT_WAKEUP, now - hardirq);
+
+	return now;
+}
+EXPORT_SYMBOL_GPL(adlink_irqstat_thread_begin);
+
+void adlink_irqstat_thread_end(struct adlink_irqstat *st, u64 start)
+{
+	u64 now = ktime_get_mono_fast_ns();
+
+	if (IS_ERR_OR_NULL(st) || now < start)
+		return;
+
+	adlink_irqstat_record(st, ADLINK_IRQSTAT_RUNTIME, now - start);
+}
+EXPORT_SYMBOL_GPL(adlink_irqstat_thread_end);
+
+static int adlink_irqstat_show(struct seq_file *s, enum adlink_irqstat_metric metric)
+{
+	struct adlink_irqstat *st = s->private;
+	struct adlink_irqstat_hist sum = { .min = U64_MAX };
+	int cpu, i;
+
+	// Sum the per-CPU copies, a sample being recorded meanwhile may be missed
+	for_each_possible_cpu(cpu) {
+		const struct adlink_irqstat_hist *h = per_cpu_ptr(st->hist, cpu) + metric;
+
+		if (!h->count)
+			continue;
+		for (i = 0; i < ADLINK_IRQSTAT_BUCKETS; i++)
+			sum.bucket[i] += h->bucket[i];
+		sum.count += h->count;
+		sum.sum += h->sum;
+		sum.min = min(sum.min, h->min);
+		sum.max = max(sum.max, h->max);
+	}
+
+	seq_printf(s, "count: %llu\n", sum.count);
+	if (!sum.count)
+		return 0;
+
+	seq_printf(s, "min_ns: %llu\n", sum.min);
+	seq_printf(s, "avg_ns: %llu\n", div64_u64(sum.sum, sum.count));
+	seq_printf(s, "max_ns: %llu\n", sum.max);
+	for (i = 0; i < ADLINK_IRQSTAT_BUCKETS; i++) {
+		if (!sum.bucket[i])
+			continue;
+		seq_printf(s, "%12llu ns: %llu\n", i ? 1ULL << i : 0, sum.bucket[i]);
+	}
+
+	return 0;
+}
+
+static int wakeup_latency_show(struct seq_file *s, void *unused)
+{
+	return adlink_irqstat_show(s, ADLINK_IRQSTAT_WAKEUP);
+}
+DEFINE_SHOW_ATTRIBUTE(wakeup_latency);
+
+static int thread_runtime_show(struct seq_file *s, void *unused)
+{
+	return adlink_irqstat_show(s, ADLINK_IRQSTAT_RUNTIME);
+}
+DEFINE_SHOW_ATTRIBUTE(thread_runtime);
+
+static ssize_t reset_write(struct file *file, const char __user *buf,
+			   size_t count, loff_t *ppos)
+{
+	struct adlink_irqstat *st = file->private_data;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(st->hist, cpu), 0,
+		       sizeof(struct adlink_irqstat_hist) * ADLINK_IRQSTAT_NR);
+
+	return count;
+}
+
+static const struct file_operations reset_fops = {
+	.owner	= THIS_MODULE,
+	.open	= simple_open,
+	.write	= reset_write,
+	.llseek	= noop_llseek,
+};
+
+static void adlink_irqstat_release(void *data)
+{
+	struct adlink_irqstat *st = data;
+
+	debugfs_remove_recursive(st->dir);
+	free_percpu(st->hist);
+}
+
+/*
+ * Create the histograms of @dev. Must be called before the IRQ is requested,
+ * so that they are released only after the IRQ has been freed.
+ */
+struct adlink_irqstat *devm_adlink_irqstat_create(struct device *dev)
+{
+	struct adlink_irqstat *st;
+	int ret;
+
+	st = devm_kzalloc(dev, sizeof(*st), GFP_KERNEL);
+	if (!st)
+		return ERR_PTR(-ENOMEM);
+
+	st->hist = __alloc_percpu(sizeof(struct adlink_irqstat_hist) * ADLINK_IRQSTAT_NR,
+				  __alignof__(struct adlink_irqstat_hist));
+	if (!st->hist)
+		return ERR_PTR(-ENOMEM);
+
+	st->dir = debugfs_create_dir(dev_name(dev), adlink_debugfs_root);
+	debugfs_create_file("wakeup_latency", 0444, st->dir, st, &wakeup_latency_fops);
+	debugfs_create_file("thread_runtime", 0444, st->dir, st, &thread_runtime_fops);
+	debugfs_create_file("reset", 0200, st->dir, st, &reset_fops);
+
+	ret = devm_add_action_or_reset(dev, adlink_irqstat_release, st);
+	if (ret)
+		return ERR_PTR(ret);
+
+	return st;
+}
+EXPORT_SYMBOL_GPL(devm_adlink_irqstat_create);
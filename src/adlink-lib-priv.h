@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Internals shared between the translation units of adlink-gpio-lib.ko.
+ */
+
+#ifndef _ADLINK_LIB_PRIV_H
+#define _ADLINK_LIB_PRIV_H
+
+#include <linux/debugfs.h>
+
+#define ADLINK_LIB_NAME "adlink-gpio-lib"
+
+/* /sys/kernel/debug/adlink-gpio, may be an ERR_PTR without debugfs */
+extern struct dentry *adlink_debugfs_root;
+
+#endif /* _ADLINK_LIB_PRIV_H */
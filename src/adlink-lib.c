@@ -0,0 +1,85 @@
+/*
+ * adlink-lib.c -- shared facilities of the ADLINK GPIO drivers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/debugfs.h>
+#include <linux/timekeeping.h>
+
+#include "adlink-gpio-event.h"
+#include "adlink-lib.h"
+#include "adlink-lib-priv.h"
+
+#define CREATE_TRACE_POINTS
+#include "adlink-trace.h"
+
+EXPORT_TRACEPOINT_SYMBOL_GPL(adlink_gpio_edge);
+EXPORT_TRACEPOINT_SYMBOL_GPL(adlink_gpio_thread);
+EXPORT_TRACEPOINT_SYMBOL_GPL(adlink_gprmc_write);
+EXPORT_TRACEPOINT_SYMBOL_GPL(adlink_pps_gen_edge);
+EXPORT_TRACEPOINT_SYMBOL_GPL(adlink_pps_gen_late);
+
+struct dentry *adlink_debugfs_root;
+
+void adlink_event_clocks(struct adlink_gpio_event *ev)
+{
+	struct system_time_snapshot snap;
+	ktime_t offs_real, mono, boot, tai;
+
+	do {
+		offs_real = ktime_mono_to_real(0);
+
+		// REALTIME and MONOTONIC_RAW from a single clocksource read
+		ktime_get_snapshot(&snap);
+
+		// The others are fixed offsets from it, which only move on clock steps and resume
+		mono = ktime_sub(snap.real, offs_real);
+		boot = ktime_mono_to_any(mono, TK_OFFS_BOOT);
+		tai = ktime_mono_to_any(mono, TK_OFFS_TAI);
+
+		// Retry if a step moved the offset around the snapshot, a seqcount read rather than another snapshot
+	} while (ktime_mono_to_real(0) != offs_real);
+
+	// The counter of the same read, for dating a GTE stamp against it
+	ev->raw = snap.cycles;
+	ev->ns = ktime_to_ns(snap.real);
+	ev->mono_ns = ktime_to_ns(mono);
+	ev->mono_raw_ns = ktime_to_ns(snap.raw);
+	ev->boot_ns = ktime_to_ns(boot);
+	ev->tai_ns = ktime_to_ns(tai);
+}
+EXPORT_SYMBOL_GPL(adlink_event_clocks);
+
+void adlink_event_backdate(struct adlink_gpio_event *ev, u64 age_ns)
+{
+	ev->ns -= age_ns;
+	ev->mono_ns -= age_ns;
+	ev->mono_raw_ns -= age_ns;
+	ev->boot_ns -= age_ns;
+	ev->tai_ns -= age_ns;
+}
+EXPORT_SYMBOL_GPL(adlink_event_backdate);
+
+static int __init adlink_lib_init(void)
+{
+	adlink_debugfs_root = debugfs_create_dir("adlink-gpio", NULL);
+
+	return 0;
+}
+
+static void __exit adlink_lib_exit(void)
+{
+	debugfs_remove_recursive(adlink_debugfs_root);
+}
+
+module_init(adlink_lib_init);
+module_exit(adlink_lib_exit);
+MODULE_AUTHOR("Ting Chang <ting.chang@adlinktech.com>");
+MODULE_DESCRIPTION("Shared facilities of the ADLINK GPIO drivers");
+MODULE_LICENSE("GPL");
+MODULE_VERSION("1.0.0");
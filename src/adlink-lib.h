@@ -0,0 +1,160 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Shared facilities of the ADLINK GPIO drivers, provided by adlink-gpio-lib.ko.
+ */
+
+#ifndef _ADLINK_LIB_H
+#define _ADLINK_LIB_H
+
+#include <linux/device.h>
+#include <linux/types.h>
+
+/*
+ * IRQ latency instrumentation
+ *
+ * Records how long the threaded half waits after the hard IRQ
+ * (wakeup_latency) and how long it runs (thread_runtime) into per-CPU log2
+ * histograms, shown under /sys/kernel/debug/adlink-gpio/<device>/.
+ *
+ *	top half:	adlink_irqstat_hardirq(st);
+ *	thread:		start = adlink_irqstat_thread_begin(st);
+ *			...
+ *			adlink_irqstat_thread_end(st, start);
+ *
+ * All hooks are lock-free and accept a NULL or ERR_PTR handle.
+ */
+struct adlink_irqstat;
+
+struct adlink_irqstat *devm_adlink_irqstat_create(struct device *dev);
+void adlink_irqstat_hardirq(struct adlink_irqstat *st);
+u64 adlink_irqstat_thread_begin(struct adlink_irqstat *st);
+void adlink_irqstat_thread_end(struct adlink_irqstat *st, u64 start);
+
+/*
+ * IRQ CPU affinity and IRQ thread scheduling
+ *
+ * Reads the "irq-affinity", "irq-thread-cpu" and "irq-thread-priority"
+ * properties of the device and exposes them in sysfs next to irq_thread,
+ * the pid, CPU and priority the thread really runs with.
+ *
+ *	probe:		af = devm_adlink_irqaff_create(dev);
+ *			devm_request_threaded_irq(dev, irq, ...);
+ *			devm_adlink_irqaff_add_irq(dev, af, irq);
+ *	thread:		adlink_irqaff_thread(af);
+ *
+ * The hard IRQ affinity is set when the IRQ is added and on every sysfs
+ * write. The thread settings are applied by the thread itself, on its next
+ * run, because threaded IRQs do not expose their task.
+ */
+struct adlink_irqaff;
+
+struct adlink_irqaff *devm_adlink_irqaff_create(struct device *dev);
+int devm_adlink_irqaff_add_irq(struct device *dev, struct adlink_irqaff *af, int irq);
+void adlink_irqaff_thread(struct adlink_irqaff *af);
+
+/*
+ * Edge timestamps
+ *
+ * adlink_event_clocks() fills ns, mono_ns, mono_raw_ns, boot_ns and tai_ns
+ * of an event record from one timekeeping snapshot, so that they agree with
+ * each other, also across a second boundary. raw gets the clocksource count
+ * of that snapshot, for adlink_gte_edge_age(). adlink_event_backdate() moves
+ * all of them back, e.g. by the age of a GTE stamp. Both are safe in hard
+ * IRQ context.
+ */
+struct adlink_gpio_event;
+
+void adlink_event_clocks(struct adlink_gpio_event *ev);
+void adlink_event_backdate(struct adlink_gpio_event *ev, u64 age_ns);
+
+/*
+ * Edge event device
+ *
+ * /dev/<prefix>-<label> with the ring of adlink-gpio-event.h. Consumers
+ * either mmap() it or read() whole batches of records, and may poll() for
+ * wakeup_watermark pending records (sysfs attribute of the misc device).
+ *
+ *	top half:	seq = adlink_evdev_push(ed, ns, raw, flags, channel);
+ *		or	seq = adlink_evdev_push_event(ed, &rec);
+ *	timeout:	adlink_evdev_flush(ed);
+ *
+ * adlink_evdev_push() is safe in hard IRQ context, but only one producer
+ * may run at a time. It returns the sequence number given to the edge,
+ * also when the ring was full and the edge was dropped.
+ * adlink_evdev_push_event() stores a whole record filled in by the caller,
+ * for drivers that take more than CLOCK_REALTIME, seq is set by the ring.
+ * adlink_evdev_flush() wakes readers for the records pushed so far, even
+ * below the watermark, e.g. when a batch did not complete in time. It is
+ * safe in hard IRQ context as well.
+ */
+struct adlink_evdev;
+
+struct adlink_evdev *devm_adlink_evdev_create(struct device *dev, const char *prefix);
+u64 adlink_evdev_push(struct adlink_evdev *ed, u64 ns, u64 raw, u32 flags,
+		      u32 channel);
+u64 adlink_evdev_push_event(struct adlink_evdev *ed, const struct adlink_gpio_event *rec);
+void adlink_evdev_flush(struct adlink_evdev *ed);
+u64 adlink_evdev_overruns(struct adlink_evdev *ed);
+
+/*
+ * Hard IRQ to thread event handoff
+ *
+ * A single producer, single consumer queue of whole event records, so that
+ * every edge the top half captured reaches the thread intact, also when
+ * several arrive before the thread runs:
+ *
+ *	top half:	adlink_evq_push(q, &ev);
+ *	thread:		while (adlink_evq_pop(q, &ev))
+ *				...
+ *
+ * Neither side takes a lock or waits, but only one producer and one
+ * consumer may run at a time. An event that does not fit is dropped and
+ * the next one that does is flagged with ADLINK_GPIO_EVENT_OVERRUN. The
+ * "handoff" sysfs attribute counts delivered, dropped and coalesced
+ * events (popped in the same run as an earlier one) and the peak depth.
+ */
+struct adlink_evq;
+
+struct adlink_evq *devm_adlink_evq_create(struct device *dev, unsigned int events);
+bool adlink_evq_push(struct adlink_evq *q, const struct adlink_gpio_event *ev);
+bool adlink_evq_pop(struct adlink_evq *q, struct adlink_gpio_event *ev);
+
+/*
+ * PPS quality statistics
+ *
+ * Fed with the assert timestamp of every PPS edge, keeps the offset to the
+ * system second, period jitter, rate and drift against the system clock and
+ * the overlapping Allan deviation at tau = 1..1000s, in a fixed amount of
+ * memory. Shown under <device>/quality/ in sysfs.
+ *
+ *	probe:		ps = devm_adlink_ppsstat_create(dev);
+ *	thread:		adlink_ppsstat_edge(ps, ns);
+ *
+ * adlink_ppsstat_edge() may sleep and accepts a NULL or ERR_PTR handle.
+ */
+struct adlink_ppsstat;
+
+struct adlink_ppsstat *devm_adlink_ppsstat_create(struct device *dev);
+void adlink_ppsstat_edge(struct adlink_ppsstat *ps, u64 ns);
+
+/*
+ * TSC to system clock correlation
+ *
+ * Samples (TSC, CLOCK_MONOTONIC) pairs every period and fits offset and
+ * rate over a sliding window of them. Hardware timestamps taken in TSC
+ * ticks, e.g. by GTE, are then converted to CLOCK_MONOTONIC and
+ * CLOCK_REALTIME:
+ *
+ *	probe:		tc = devm_adlink_tsccorr_create(dev, period_ms);
+ *	any context:	adlink_tsccorr_convert(tc, tsc, &real_ns, &mono_ns);
+ *
+ * adlink_tsccorr_convert() takes no lock and does not wait for the sampler,
+ * also in hard IRQ and NMI context. It returns false for a NULL or ERR_PTR
+ * handle. The fit and its residuals are shown in sysfs (tsc_*).
+ */
+struct adlink_tsccorr;
+
+struct adlink_tsccorr *devm_adlink_tsccorr_create(struct device *dev, unsigned int period_ms);
+bool adlink_tsccorr_convert(struct adlink_tsccorr *tc, u64 tsc, u64 *real_ns, u64 *mono_ns);
+
+#endif /* _ADLINK_LIB_H */
@@ -19,10 +19,16 @@
 #include <linux/module.h>
 #include <linux/init.h>
 #include <linux/platform_device.h>
+#include <linux/of.h>
 #include <linux/time.h>
 #include <linux/hrtimer.h>
-#include <linux/gpio.h>
-#include <linux/of_gpio.h>
+#include <linux/workqueue.h>
+#include <linux/math64.h>
+#include <linux/bitmap.h>
+#include <linux/property.h>
+#include <linux/gpio/consumer.h>
+
+#include "adlink-trace.h"
 
 #define ADLINK_PPS_GEN_GPIO "adlink-pps-gen-gpio"
 
@@ -35,115 +41,392 @@ MODULE_LICENSE("GPL");
 #define GPIO_PULSE_WIDTH_MAX_NS (100 * NSEC_PER_USEC)   /* 100us */
 #define SAFETY_INTERVAL_NS      (10 * NSEC_PER_USEC)    /* 10us */
 
+#define PPS_GEN_MAX_CHANNELS    32
+#define PPS_GEN_RATE_MAX_HZ     1000
+
+/* Servo tuning, gains are right shifts: Kp = 1/4, Ki = 1/8. */
+#define PPS_GEN_SERVO_KP_SHIFT  2
+#define PPS_GEN_SERVO_KI_SHIFT  3
+#define PPS_GEN_LEAD_MAX_NS     (500 * NSEC_PER_USEC)   /* 500us */
+#define PPS_GEN_COMP_MAX_NS     (100 * NSEC_PER_USEC)   /* 100us */
+#define PPS_GEN_LOCK_NS         (1 * NSEC_PER_USEC)     /* 1us */
+#define PPS_GEN_LOCK_COUNT      8                       /* on-time edges */
+#define PPS_GEN_JITTER_SHIFT    4                       /* EWMA weight 1/16 */
+
 enum pps_gen_gpio_level {
 	PPS_GPIO_LOW = 0,
 	PPS_GPIO_HIGH
 };
 
+enum pps_gen_servo_state {
+	PPS_GEN_SERVO_UNLOCKED = 0,     /* started or skipped a pulse */
+	PPS_GEN_SERVO_LOCKING,          /* converging */
+	PPS_GEN_SERVO_LOCKED            /* PPS_GEN_LOCK_COUNT edges in band */
+};
+
+static const char * const pps_gen_servo_state_names[] = {
+	[PPS_GEN_SERVO_UNLOCKED] = "unlocked",
+	[PPS_GEN_SERVO_LOCKING] = "locking",
+	[PPS_GEN_SERVO_LOCKED] = "locked",
+};
+
+/* PI controller in positional form, out = Kp * err + Ki * sum(err). */
+struct pps_gen_pi {
+	s64 out;
+	s64 integral;
+};
+
 /* Module parameters. */
 static unsigned int gpio_pulse_width_ns = GPIO_PULSE_WIDTH_DEF_NS;
 MODULE_PARM_DESC(width, "Delay between setting and dropping the signal (ns)");
 module_param_named(width, gpio_pulse_width_ns, uint, 0000);
 
+/*
+ * One output. Its pulses end on the instants sec + n / rate_hz + phase_ns,
+ * n = 0 .. rate_hz - 1, so all outputs stay locked to the same second.
+ */
+struct pps_gen_channel {
+	const char *label;
+	struct gpio_desc *gpio;
+	u32 rate_hz;
+	u32 phase_ns;
+	u32 width_ns;
+
+	/* Current pulse, owned by the timer callback */
+	time64_t sec;
+	u32 pulse;                      /* n of the pulse within sec */
+	bool high;                      /* asserted, the deassert is next */
+	ktime_t on_time;                /* instant the pulse ends on */
+	ktime_t assert_time;            /* requested edge times of the pulse */
+	ktime_t deassert_time;
+
+	unsigned long pulses;
+	unsigned long late_count;
+};
+
 /* Device private data structure. */
 struct pps_gen_gpio_devdata {
-	struct gpio_desc *pps_gpio;     /* GPIO port descriptor */
-	struct gpio_desc *pps_db50;     /* GPIO port descriptor */
+	struct pps_gen_channel *channels;
+	unsigned int nr_channels;
+	struct gpio_desc **descs;       /* [nr_channels], all outputs */
+	struct gpio_desc **due_descs;   /* [nr_channels], outputs of one edge */
 	struct hrtimer timer;
-	long gpio_instr_time;           /* measured port write time (ns) */
+	ktime_t armed_edge;             /* earliest edge when the timer was armed */
+	long gpio_instr_time;           /* calibrated write time of one output (ns) */
+	long *write_extra_ns;           /* [n], write of n outputs minus that of one */
+	struct pps_gen_pi lead;         /* timer expiry ahead of an edge (ns) */
+	s64 lead_max_ns;                /* below the shortest pulse, see pps_gen_lead_max() */
+	struct pps_gen_pi comp;         /* deassert write ahead of the second (ns) */
+	enum pps_gen_servo_state servo_state;
+	unsigned int lock_count;        /* consecutive seconds within PPS_GEN_LOCK_NS */
+	s64 phase_error_ns;             /* last on-time edge minus its instant */
+	s64 slack_ns;                   /* last timer expiry ahead of its edge */
+	u64 phase_ms;                   /* EWMA of phase_error_ns^2 */
+	ktime_t late_time;              /* set when a pulse had to be skipped */
+	struct work_struct log_work;    /* logs outside of the IRQ-off region */
+	u64 irqoff_last_ns;             /* IRQ-off time of the last edge */
+	u64 irqoff_max_ns;
+	u64 skew_last_ns;               /* write span of the last multi-output edge */
+	u64 skew_max_ns;
+	unsigned long late_count;
 };
 
-/* Average of hrtimer interrupt latency. */
-static long hrtimer_avg_latency = SAFETY_INTERVAL_NS;
+static void pps_gen_pi_init(struct pps_gen_pi *pi, s64 out)
+{
+	pi->out = out;
+	pi->integral = out << PPS_GEN_SERVO_KI_SHIFT;
+}
+
+static void pps_gen_pi_update(struct pps_gen_pi *pi, s64 err, s64 max)
+{
+	pi->integral = clamp_t(s64, pi->integral + err,
+			       0, max << PPS_GEN_SERVO_KI_SHIFT);
+	pi->out = clamp_t(s64, (err >> PPS_GEN_SERVO_KP_SHIFT)
+				+ (pi->integral >> PPS_GEN_SERVO_KI_SHIFT),
+			  0, max);
+}
+
+/* The timer fired @slack ns before the edge it was armed for. */
+static void pps_gen_servo_lead(struct pps_gen_gpio_devdata *devdata, s64 slack)
+{
+	devdata->slack_ns = slack;
+
+	/* A late wakeup costs a pulse, so take the whole miss at once. */
+	if (slack < 0)
+		devdata->lead.integral -= slack << PPS_GEN_SERVO_KI_SHIFT;
+
+	pps_gen_pi_update(&devdata->lead, SAFETY_INTERVAL_NS - slack,
+			  devdata->lead_max_ns);
+}
+
+/*
+ * A lead longer than a pulse would put both of its edges into one callback
+ * and keep interrupts off for the whole pulse. Stay SAFETY_INTERVAL_NS below
+ * the shortest one, or at half of it for pulses that short.
+ */
+static s64 pps_gen_lead_max(struct pps_gen_gpio_devdata *devdata)
+{
+	s64 width = PPS_GEN_LEAD_MAX_NS + SAFETY_INTERVAL_NS;
+	unsigned int i;
+
+	for (i = 0; i < devdata->nr_channels; i++)
+		width = min_t(s64, width, devdata->channels[i].width_ns);
+
+	return max_t(s64, width - SAFETY_INTERVAL_NS, width / 2);
+}
+
+/* An on-time edge was written @err ns after its instant. */
+static void pps_gen_servo_phase(struct pps_gen_gpio_devdata *devdata, s64 err)
+{
+	s64 ms_delta;
+
+	devdata->phase_error_ns = err;
+	pps_gen_pi_update(&devdata->comp, err, PPS_GEN_COMP_MAX_NS);
+
+	ms_delta = (s64)(err * err) - (s64)devdata->phase_ms;
+	devdata->phase_ms += ms_delta >> PPS_GEN_JITTER_SHIFT;
+
+	if (abs(err) > PPS_GEN_LOCK_NS) {
+		devdata->lock_count = 0;
+		devdata->servo_state = PPS_GEN_SERVO_LOCKING;
+	} else if (++devdata->lock_count >= PPS_GEN_LOCK_COUNT) {
+		devdata->servo_state = PPS_GEN_SERVO_LOCKED;
+	}
+}
+
+/* Requested edge times of the current pulse of @ch. */
+static void pps_gen_set_pulse(struct pps_gen_gpio_devdata *devdata,
+			      struct pps_gen_channel *ch)
+{
+	ch->on_time = ktime_set(ch->sec, div_u64((u64)ch->pulse * NSEC_PER_SEC,
+						 ch->rate_hz) + ch->phase_ns);
+	ch->deassert_time = ktime_sub_ns(ch->on_time, devdata->comp.out);
+	ch->assert_time = ktime_sub_ns(ch->deassert_time, ch->width_ns);
+}
+
+static void pps_gen_next_pulse(struct pps_gen_gpio_devdata *devdata,
+			       struct pps_gen_channel *ch)
+{
+	if (++ch->pulse == ch->rate_hz) {
+		ch->pulse = 0;
+		ch->sec++;
+	}
+	pps_gen_set_pulse(devdata, ch);
+}
+
+/* Move @ch to its first pulse that can still be asserted after @now. */
+static void pps_gen_resync(struct pps_gen_gpio_devdata *devdata,
+			   struct pps_gen_channel *ch, ktime_t now)
+{
+	s32 rem;
+
+	ch->sec = div_s64_rem(ktime_to_ns(now) + devdata->comp.out + ch->width_ns
+			      - ch->phase_ns, NSEC_PER_SEC, &rem);
+	ch->pulse = div_u64((u64)rem * ch->rate_hz, NSEC_PER_SEC);
+	ch->high = false;
+	pps_gen_set_pulse(devdata, ch);
+
+	// Rounding leaves at most one pulse to step over
+	while (!ktime_after(ch->assert_time, now))
+		pps_gen_next_pulse(devdata, ch);
+}
+
+static ktime_t pps_gen_channel_edge(struct pps_gen_channel *ch)
+{
+	return ch->high ? ch->deassert_time : ch->assert_time;
+}
+
+/* The timer wheel: the earliest edge of all channels is the next to write. */
+static ktime_t pps_gen_next_edge(struct pps_gen_gpio_devdata *devdata)
+{
+	ktime_t edge = KTIME_MAX;
+	unsigned int i;
+
+	for (i = 0; i < devdata->nr_channels; i++)
+		edge = min(edge, pps_gen_channel_edge(&devdata->channels[i]));
+
+	return edge;
+}
+
+/* How long before an edge its timer has to fire. */
+static s64 pps_gen_timer_lead(struct pps_gen_gpio_devdata *devdata)
+{
+	return devdata->lead.out;
+}
+
+/* Skip the pulses whose assert edge the timer expiry @expire is already past. */
+static void pps_gen_skip_late(struct pps_gen_gpio_devdata *devdata,
+			      ktime_t expire)
+{
+	struct pps_gen_channel *ch;
+	bool late = false;
+	unsigned int i;
+
+	for (i = 0; i < devdata->nr_channels; i++) {
+		ch = &devdata->channels[i];
+		if (ch->high || !ktime_after(expire, ch->assert_time))
+			continue;
+
+		trace_adlink_pps_gen_late(i, ktime_to_ns(ch->assert_time),
+					  ktime_to_ns(expire));
+		ch->late_count++;
+		devdata->late_time = expire;
+		devdata->late_count++;
+		devdata->lock_count = 0;
+		devdata->servo_state = PPS_GEN_SERVO_UNLOCKED;
+		pps_gen_resync(devdata, ch, expire);
+		late = true;
+	}
+	if (late)
+		schedule_work(&devdata->log_work);
+}
+
+/*
+ * Spin until @edge and drive every output due at it with one array write.
+ * gpiolib uses one set_multiple() per controller where the driver has it,
+ * otherwise (gpio-tegra186) it still writes pin by pin. The write starts
+ * early by what the calibration found more outputs to cost than one, so
+ * that it completes on time whatever the number of outputs. Returns the
+ * time of the write, @due gets the channels that were written.
+ */
+static ktime_t pps_gen_edge(struct pps_gen_gpio_devdata *devdata,
+			    ktime_t edge, unsigned long *due)
+{
+	DECLARE_BITMAP(values, PPS_GEN_MAX_CHANNELS);
+	struct pps_gen_channel *ch;
+	unsigned int i, n = 0;
+	ktime_t now;
+
+	bitmap_zero(due, PPS_GEN_MAX_CHANNELS);
+	bitmap_zero(values, PPS_GEN_MAX_CHANNELS);
+	for (i = 0; i < devdata->nr_channels; i++) {
+		ch = &devdata->channels[i];
+		if (pps_gen_channel_edge(ch) != edge)
+			continue;
+		__set_bit(i, due);
+		if (!ch->high)
+			__set_bit(n, values);
+		devdata->due_descs[n++] = ch->gpio;
+	}
+
+	edge = ktime_sub_ns(edge, devdata->write_extra_ns[n]);
+	do
+		now = ktime_get_real();
+	while (ktime_before(now, edge));
+
+	gpiod_set_array_value(n, devdata->due_descs, NULL, values);
+
+	return now;
+}
+
+/* A write to several outputs took @span ns, their edges are at most that far apart. */
+static void pps_gen_skew_update(struct pps_gen_gpio_devdata *devdata, s64 span)
+{
+	devdata->skew_last_ns = span;
+	if (devdata->skew_last_ns > devdata->skew_max_ns)
+		devdata->skew_max_ns = devdata->skew_last_ns;
+}
+
+static void pps_gen_irqoff_update(struct pps_gen_gpio_devdata *devdata,
+				  ktime_t start, ktime_t end)
+{
+	devdata->irqoff_last_ns = ktime_to_ns(ktime_sub(end, start));
+	if (devdata->irqoff_last_ns > devdata->irqoff_max_ns)
+		devdata->irqoff_max_ns = devdata->irqoff_last_ns;
+}
+
+static void pps_gen_log_work(struct work_struct *work)
+{
+	struct pps_gen_gpio_devdata *devdata =
+		container_of(work, struct pps_gen_gpio_devdata, log_work);
+	struct timespec64 ts;
+
+	if (devdata->late_time) {
+		ts = ktime_to_timespec64(devdata->late_time);
+		devdata->late_time = 0;
+		pr_err("We are late this time [%lld.%09ld]\n",
+		       ts.tv_sec, ts.tv_nsec);
+	}
+}
 
-/* hrtimer event callback */
+/* hrtimer event callback
+ *
+ * One timer serves the edges of all channels in time order. It is armed
+ * pps_gen_timer_lead() before the earliest pending edge, and every edge
+ * due within the lead is written in the same callback, edges of several
+ * channels at the same instant together. Interrupts are only kept off for
+ * the final spin up to those edges plus the GPIO writes, instead of for
+ * whole pulses, as the lead stays below the shortest pulse. The lead and the write compensation are servoed per
+ * device, see pps_gen_servo_lead() and pps_gen_servo_phase().
+ */
 static enum hrtimer_restart hrtimer_callback(struct hrtimer *timer)
 {
 	unsigned long irq_flags;
-	long hrtimer_latency;
 	struct pps_gen_gpio_devdata *devdata =
 		container_of(timer, struct pps_gen_gpio_devdata, timer);
-	const long time_gpio_deassert_ns =
-		NSEC_PER_SEC - devdata->gpio_instr_time;
-	const long time_gpio_assert_ns =
-		time_gpio_deassert_ns - gpio_pulse_width_ns;
-	struct timespec64 ts_expire_req, ts_expire_real, ts_gpio_instr_time,
-			ts_hrtimer_latency, ts1, ts2;
+	DECLARE_BITMAP(due, PPS_GEN_MAX_CHANNELS);
+	struct pps_gen_channel *ch;
+	ktime_t expire_real, edge, on_time, t1, t2;
+	unsigned int i;
 
 	/* We have to disable interrupts here. The idea is to prevent
 	 * other interrupts on the same processor to introduce random
-	 * lags while polling the clock; ktime_get_real_ts64() takes <1us on
+	 * lags while polling the clock; ktime_get_real() takes <1us on
 	 * most machines while other interrupt handlers can take much
 	 * more potentially.
 	 *
 	 * Note: approximate time with blocked interrupts =
-	 * gpio_pulse_width_ns + SAFETY_INTERVAL_NS + average hrtimer latency
+	 * SAFETY_INTERVAL_NS + deviation from the servoed hrtimer latency
 	 */
 	local_irq_save(irq_flags);
-
-	/* Get current timestamp and requested time to check if we are late. */
-	ktime_get_real_ts64(&ts_expire_real);
-	ts_expire_req = ktime_to_timespec64(hrtimer_get_softexpires(timer));
-	if (ts_expire_req.tv_sec != ts_expire_real.tv_sec
-	    || ts_expire_real.tv_nsec > time_gpio_assert_ns) {
-		local_irq_restore(irq_flags);
-		pr_err("We are late this time [%lld.%09ld]\n",
-		       ts_expire_real.tv_sec, ts_expire_real.tv_nsec);
-		goto done;
+	expire_real = ktime_get_real();
+	t2 = expire_real;
+
+	for (;;) {
+		/* Too late for a pulse, skip it and resync its channel. */
+		pps_gen_skip_late(devdata, expire_real);
+
+		/* Leave edges beyond the lead to the next expiry. */
+		edge = pps_gen_next_edge(devdata);
+		if (ktime_to_ns(ktime_sub(edge, t2)) > pps_gen_timer_lead(devdata))
+			break;
+
+		t1 = pps_gen_edge(devdata, edge, due);
+		t2 = ktime_get_real();
+		if (bitmap_weight(due, devdata->nr_channels) > 1)
+			pps_gen_skew_update(devdata, ktime_to_ns(ktime_sub(t2, t1)));
+
+		on_time = 0;
+		for_each_set_bit(i, due, devdata->nr_channels) {
+			ch = &devdata->channels[i];
+			trace_adlink_pps_gen_edge(i, !ch->high, ktime_to_ns(edge),
+						  ktime_to_ns(t1),
+						  ktime_to_ns(ktime_sub(t2, expire_real)));
+			if (!ch->high) {
+				ch->high = true;
+				continue;
+			}
+			on_time = ch->on_time;
+			ch->high = false;
+			ch->pulses++;
+			pps_gen_next_pulse(devdata, ch);
+		}
+
+		/* The deassert write should complete right on the instant. */
+		if (on_time)
+			pps_gen_servo_phase(devdata, ktime_to_ns(ktime_sub(t2, on_time)));
 	}
-
-	/* Busy loop until the time is right for a GPIO assert. */
-	do
-		ktime_get_real_ts64(&ts1);
-	while (ts_expire_req.tv_sec == ts1.tv_sec
-	       && ts1.tv_nsec < time_gpio_assert_ns);
-
-	/* Assert PPS GPIO. */
-	gpiod_set_value(devdata->pps_gpio, PPS_GPIO_HIGH);
-	gpiod_set_value(devdata->pps_db50, PPS_GPIO_HIGH);
-	printk("high: %lld.%09ld", ts1.tv_sec, ts1.tv_nsec);
-
-	/* Busy loop until the time is right for a GPIO deassert. */
-	do
-		ktime_get_real_ts64(&ts1);
-	while (ts_expire_req.tv_sec == ts1.tv_sec
-	       && ts1.tv_nsec < time_gpio_deassert_ns);
-
-	/* Deassert PPS GPIO. */
-	gpiod_set_value(devdata->pps_gpio, PPS_GPIO_LOW);
-	gpiod_set_value(devdata->pps_db50, PPS_GPIO_LOW);
-	printk("low: %lld.%09ld", ts1.tv_sec, ts1.tv_nsec);
-
-	ktime_get_real_ts64(&ts2);
 	local_irq_restore(irq_flags);
+	pps_gen_irqoff_update(devdata, expire_real, t2);
 
-	/* Update the calibrated GPIO set instruction time. */
-	ts_gpio_instr_time = timespec64_sub(ts2, ts1);
-	devdata->gpio_instr_time = (devdata->gpio_instr_time
-				    + timespec64_to_ns(&ts_gpio_instr_time)) / 2;
-
-done:
-	/* Update the average hrtimer latency. */
-	ts_hrtimer_latency = timespec64_sub(ts_expire_real, ts_expire_req);
-	hrtimer_latency = timespec64_to_ns(&ts_hrtimer_latency);
-
-	/* If the new latency value is bigger then the old, use the new
-	 * value, if not then slowly move towards the new value. This
-	 * way it should be safe in bad conditions and efficient in
-	 * good conditions.
-	 */
-	if (hrtimer_latency > hrtimer_avg_latency)
-		hrtimer_avg_latency = hrtimer_latency;
-	else
-		hrtimer_avg_latency =
-			(3 * hrtimer_avg_latency + hrtimer_latency) / 4;
+	/* Keep the timer expiry SAFETY_INTERVAL_NS ahead of the edge. */
+	pps_gen_servo_lead(devdata, ktime_to_ns(ktime_sub(devdata->armed_edge,
+							  expire_real)));
 
 	/* Update the hrtimer expire time. */
+	devdata->armed_edge = edge;
 	hrtimer_set_expires(timer,
-			    ktime_set(ts_expire_req.tv_sec + 1,
-				      time_gpio_assert_ns
-				      - hrtimer_avg_latency
-				      - SAFETY_INTERVAL_NS));
+			    ktime_sub_ns(edge, pps_gen_timer_lead(devdata)));
 
 	return HRTIMER_RESTART;
 }
@@ -152,38 +435,321 @@ done:
 #define PPS_GEN_CALIBRATE_LOOPS 100
 static void pps_gen_calibrate(struct pps_gen_gpio_devdata *devdata)
 {
+	DECLARE_BITMAP(values, PPS_GEN_MAX_CHANNELS);
+	unsigned int n;
 	int i;
-	long time_acc = 0;
-
-	for (i = 0; i < PPS_GEN_CALIBRATE_LOOPS; i++) {
-		struct timespec64 ts1, ts2, ts_delta;
-		unsigned long irq_flags;
-
-		local_irq_save(irq_flags);
-		ktime_get_real_ts64(&ts1);
-		gpiod_set_value(devdata->pps_gpio, PPS_GPIO_LOW);
-		ktime_get_real_ts64(&ts2);
-		local_irq_restore(irq_flags);
 
-		ts_delta = timespec64_sub(ts2, ts1);
-		time_acc += timespec64_to_ns(&ts_delta);
+	/* Edges write any subset of the outputs, so time every size of it. */
+	bitmap_zero(values, PPS_GEN_MAX_CHANNELS);
+	for (n = 1; n <= devdata->nr_channels; n++) {
+		long time_acc = 0;
+
+		for (i = 0; i < PPS_GEN_CALIBRATE_LOOPS; i++) {
+			struct timespec64 ts1, ts2, ts_delta;
+			unsigned long irq_flags;
+
+			local_irq_save(irq_flags);
+			ktime_get_real_ts64(&ts1);
+			gpiod_set_array_value(n, devdata->descs, NULL, values);
+			ktime_get_real_ts64(&ts2);
+			local_irq_restore(irq_flags);
+
+			ts_delta = timespec64_sub(ts2, ts1);
+			time_acc += timespec64_to_ns(&ts_delta);
+		}
+
+		time_acc /= PPS_GEN_CALIBRATE_LOOPS;
+		if (n == 1)
+			devdata->gpio_instr_time = time_acc;
+		devdata->write_extra_ns[n] = max(time_acc - devdata->gpio_instr_time, 0L);
 	}
-
-	devdata->gpio_instr_time = time_acc / PPS_GEN_CALIBRATE_LOOPS;
-	pr_info("PPS GPIO set takes %ldns, acc=%ld\n", devdata->gpio_instr_time, time_acc);
+	pr_info("PPS GPIO set takes %ldns, %u outputs at once %ldns more\n",
+		devdata->gpio_instr_time, devdata->nr_channels,
+		devdata->write_extra_ns[devdata->nr_channels]);
+
+	/* The servo starts from one output, write_extra_ns covers the rest. */
+	pps_gen_pi_init(&devdata->comp, devdata->gpio_instr_time);
+	devdata->lead_max_ns = pps_gen_lead_max(devdata);
+	pps_gen_pi_init(&devdata->lead, min_t(s64, 2 * SAFETY_INTERVAL_NS,
+					      devdata->lead_max_ns));
+	devdata->servo_state = PPS_GEN_SERVO_UNLOCKED;
 }
 
 static ktime_t pps_gen_first_timer_event(struct pps_gen_gpio_devdata *devdata)
 {
+	struct pps_gen_channel *ch;
 	struct timespec64 ts;
+	unsigned int i;
 
 	ktime_get_real_ts64(&ts);
-	/* First timer callback will be triggered between 1 and 2 seconds from
-	 * now, synchronized to the tv_sec increment of the wall-clock time.
+	/* Every channel starts with the first pulse of the next second of
+	 * the wall-clock time, so they all share the same phase reference.
 	 */
-	return ktime_set(ts.tv_sec + 1,
-			 NSEC_PER_SEC - gpio_pulse_width_ns
-			 - devdata->gpio_instr_time - 3 * SAFETY_INTERVAL_NS);
+	for (i = 0; i < devdata->nr_channels; i++) {
+		ch = &devdata->channels[i];
+		ch->sec = ts.tv_sec + 1;
+		ch->pulse = 0;
+		ch->high = false;
+		pps_gen_set_pulse(devdata, ch);
+	}
+	devdata->armed_edge = pps_gen_next_edge(devdata);
+	return ktime_sub_ns(devdata->armed_edge, 3 * SAFETY_INTERVAL_NS);
+}
+
+static ssize_t irqoff_last_ns_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct pps_gen_gpio_devdata *devdata = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%llu\n", devdata->irqoff_last_ns);
+}
+static DEVICE_ATTR_RO(irqoff_last_ns);
+
+static ssize_t irqoff_max_ns_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct pps_gen_gpio_devdata *devdata = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%llu\n", devdata->irqoff_max_ns);
+}
+
+/* Writing anything restarts the maximum. */
+static ssize_t irqoff_max_ns_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct pps_gen_gpio_devdata *devdata = dev_get_drvdata(dev);
+
+	devdata->irqoff_max_ns = 0;
+	return count;
+}
+static DEVICE_ATTR_RW(irqoff_max_ns);
+
+/*
+ * "<last> <max>" time one write took to drive several outputs at the same
+ * instant. This is the write span, the upper bound of the skew between the
+ * outputs, not a measured skew. Writing anything restarts the maximum.
+ */
+static ssize_t skew_ns_show(struct device *dev,
+			    struct device_attribute *attr, char *buf)
+{
+	struct pps_gen_gpio_devdata *devdata = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%llu %llu\n", devdata->skew_last_ns,
+		       devdata->skew_max_ns);
+}
+
+static ssize_t skew_ns_store(struct device *dev,
+			     struct device_attribute *attr,
+			     const char *buf, size_t count)
+{
+	struct pps_gen_gpio_devdata *devdata = dev_get_drvdata(dev);
+
+	devdata->skew_max_ns = 0;
+	return count;
+}
+static DEVICE_ATTR_RW(skew_ns);
+
+static ssize_t phase_error_ns_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct pps_gen_gpio_devdata *devdata = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%lld\n", devdata->phase_error_ns);
+}
+static DEVICE_ATTR_RO(phase_error_ns);
+
+static ssize_t jitter_rms_ns_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct pps_gen_gpio_devdata *devdata = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%lu\n",
+		       (unsigned long)int_sqrt64(devdata->phase_ms));
+}
+static DEVICE_ATTR_RO(jitter_rms_ns);
+
+static ssize_t servo_state_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct pps_gen_gpio_devdata *devdata = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%s\n",
+		       pps_gen_servo_state_names[devdata->servo_state]);
+}
+static DEVICE_ATTR_RO(servo_state);
+
+static ssize_t servo_lead_ns_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct pps_gen_gpio_devdata *devdata = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%lld\n", devdata->lead.out);
+}
+static DEVICE_ATTR_RO(servo_lead_ns);
+
+static ssize_t servo_compensation_ns_show(struct device *dev,
+					  struct device_attribute *attr,
+					  char *buf)
+{
+	struct pps_gen_gpio_devdata *devdata = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%lld\n", devdata->comp.out);
+}
+static DEVICE_ATTR_RO(servo_compensation_ns);
+
+static ssize_t timer_slack_ns_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct pps_gen_gpio_devdata *devdata = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%lld\n", devdata->slack_ns);
+}
+static DEVICE_ATTR_RO(timer_slack_ns);
+
+static ssize_t late_count_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct pps_gen_gpio_devdata *devdata = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%lu\n", devdata->late_count);
+}
+static DEVICE_ATTR_RO(late_count);
+
+/* One "<label> <rate_hz> <phase_ns> <width_ns> <pulses> <late>" line per channel */
+static ssize_t channels_show(struct device *dev,
+			     struct device_attribute *attr, char *buf)
+{
+	struct pps_gen_gpio_devdata *devdata = dev_get_drvdata(dev);
+	struct pps_gen_channel *ch;
+	unsigned int i;
+	ssize_t len = 0;
+
+	for (i = 0; i < devdata->nr_channels; i++) {
+		ch = &devdata->channels[i];
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s %u %u %u %lu %lu\n",
+				 ch->label, ch->rate_hz, ch->phase_ns, ch->width_ns,
+				 READ_ONCE(ch->pulses), READ_ONCE(ch->late_count));
+	}
+
+	return len;
+}
+static DEVICE_ATTR_RO(channels);
+
+static struct attribute *pps_gen_gpio_attrs[] = {
+	&dev_attr_channels.attr,
+	&dev_attr_irqoff_last_ns.attr,
+	&dev_attr_irqoff_max_ns.attr,
+	&dev_attr_skew_ns.attr,
+	&dev_attr_late_count.attr,
+	&dev_attr_phase_error_ns.attr,
+	&dev_attr_jitter_rms_ns.attr,
+	&dev_attr_servo_state.attr,
+	&dev_attr_servo_lead_ns.attr,
+	&dev_attr_servo_compensation_ns.attr,
+	&dev_attr_timer_slack_ns.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(pps_gen_gpio);
+
+static int pps_gen_channel_init(struct device *dev,
+				struct pps_gen_channel *ch,
+				struct fwnode_handle *fwnode, const char *con_id)
+{
+	u32 period;
+
+	ch->rate_hz = 1;
+	ch->width_ns = gpio_pulse_width_ns;
+	if (fwnode) {
+		if (fwnode_property_read_string(fwnode, "label", &ch->label))
+			ch->label = fwnode_get_name(fwnode);
+		fwnode_property_read_u32(fwnode, "rate-hz", &ch->rate_hz);
+		fwnode_property_read_u32(fwnode, "phase-ns", &ch->phase_ns);
+		fwnode_property_read_u32(fwnode, "pulse-width-ns", &ch->width_ns);
+		ch->gpio = devm_fwnode_gpiod_get(dev, fwnode, NULL, GPIOD_OUT_LOW,
+						 ch->label);
+	} else {
+		ch->label = con_id;
+		ch->gpio = devm_gpiod_get(dev, con_id, GPIOD_OUT_LOW);
+	}
+	if (IS_ERR(ch->gpio)) {
+		dev_err(dev, "Cannot get %s GPIO [%ld]\n", ch->label, PTR_ERR(ch->gpio));
+		return PTR_ERR(ch->gpio);
+	}
+
+	if (!ch->rate_hz || ch->rate_hz > PPS_GEN_RATE_MAX_HZ) {
+		dev_err(dev, "%s: rate-hz should be 1 to %d\n", ch->label,
+			PPS_GEN_RATE_MAX_HZ);
+		return -EINVAL;
+	}
+	period = NSEC_PER_SEC / ch->rate_hz;
+	if (ch->phase_ns >= period || !ch->width_ns || ch->width_ns >= period) {
+		dev_err(dev, "%s: phase-ns and pulse-width-ns should be below the %uns period\n",
+			ch->label, period);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * Every child node with a "gpios" property is an output. Without any, the
+ * legacy pps-mcu-gpio and pps-db50-gpio properties give two 1Hz outputs.
+ */
+static int pps_gen_channels_init(struct device *dev,
+				 struct pps_gen_gpio_devdata *devdata)
+{
+	static const char * const legacy[] = { "pps-mcu", "pps-db50" };
+	struct fwnode_handle *child;
+	unsigned int n = 0;
+	int ret;
+
+	device_for_each_child_node(dev, child) {
+		if (fwnode_property_present(child, "gpios"))
+			n++;
+	}
+	if (n > PPS_GEN_MAX_CHANNELS) {
+		dev_err(dev, "%u outputs, at most %d are supported\n", n,
+			PPS_GEN_MAX_CHANNELS);
+		return -EINVAL;
+	}
+
+	devdata->channels = devm_kcalloc(dev, n ? n : ARRAY_SIZE(legacy),
+					 sizeof(*devdata->channels), GFP_KERNEL);
+	devdata->descs = devm_kcalloc(dev, n ? n : ARRAY_SIZE(legacy),
+				      sizeof(*devdata->descs), GFP_KERNEL);
+	devdata->due_descs = devm_kcalloc(dev, n ? n : ARRAY_SIZE(legacy),
+					  sizeof(*devdata->due_descs), GFP_KERNEL);
+	devdata->write_extra_ns = devm_kcalloc(dev, (n ? n : ARRAY_SIZE(legacy)) + 1,
+					       sizeof(*devdata->write_extra_ns), GFP_KERNEL);
+	if (!devdata->channels || !devdata->descs || !devdata->due_descs ||
+	    !devdata->write_extra_ns)
+		return -ENOMEM;
+
+	if (!n) {
+		for (n = 0; n < ARRAY_SIZE(legacy); n++) {
+			ret = pps_gen_channel_init(dev, &devdata->channels[n],
+						   NULL, legacy[n]);
+			if (ret)
+				return ret;
+		}
+		devdata->nr_channels = n;
+		return 0;
+	}
+
+	device_for_each_child_node(dev, child) {
+		if (!fwnode_property_present(child, "gpios"))
+			continue;
+		ret = pps_gen_channel_init(dev, &devdata->channels[devdata->nr_channels],
+					   child, NULL);
+		if (ret) {
+			fwnode_handle_put(child);
+			return ret;
+		}
+		devdata->nr_channels++;
+	}
+
+	return 0;
 }
 
 static int pps_gen_gpio_probe(struct platform_device *pdev)
@@ -191,68 +757,37 @@ static int pps_gen_gpio_probe(struct platform_device *pdev)
 	int ret;
 	struct device *dev = &pdev->dev;
 	struct pps_gen_gpio_devdata *devdata;
+	unsigned int i;
 
 	/* Allocate space for device info. */
 	devdata = devm_kzalloc(dev,
 			       sizeof(struct pps_gen_gpio_devdata),
 			       GFP_KERNEL);
-	if (!devdata) {
-		ret = -ENOMEM;
-		goto err_alloc;
-	}
+	if (!devdata)
+		return -ENOMEM;
 
-	/* There should be a single PPS generator GPIO pin defined in DT. */
-	if (of_gpio_named_count(dev->of_node, "pps-mcu-gpio") != 1) {
-		dev_err(dev, "There should be exactly one pps-gen GPIO defined in DT\n");
-		ret = -EINVAL;
-		goto err_dt;
-	}
-	if (of_gpio_named_count(dev->of_node, "pps-db50-gpio") != 1) {
-		dev_err(dev, "There should be exactly one pps-db50 GPIO defined in DT\n");
-		ret = -EINVAL;
-		goto err_dt;
-	}
-	devdata->pps_gpio = devm_gpiod_get(dev, "pps-mcu", GPIOD_OUT_LOW);
-	if (IS_ERR(devdata->pps_gpio)) {
-		ret = PTR_ERR(devdata->pps_gpio);
-		dev_err(dev, "Cannot get PPS GPIO [%d]\n", ret);
-		goto err_gpio_get;
-	}
-	devdata->pps_db50 = devm_gpiod_get(dev, "pps-db50", GPIOD_OUT_LOW);
-	if (IS_ERR(devdata->pps_db50)) {
-		ret = PTR_ERR(devdata->pps_db50);
-		dev_err(dev, "Cannot get PPS-DB50 GPIO [%d]\n", ret);
-		goto err_gpio_get;
-	}
+	/* Outputs setup */
+	ret = pps_gen_channels_init(dev, devdata);
+	if (ret)
+		return ret;
 	platform_set_drvdata(pdev, devdata);
 
-	ret = gpiod_direction_output(devdata->pps_gpio, PPS_GPIO_HIGH);
-	if (ret < 0) {
-		dev_err(dev, "Cannot configure PPS GPIO\n");
-		goto err_gpio_dir;
-	}
-	ret = gpiod_direction_output(devdata->pps_db50, PPS_GPIO_HIGH);
-	if (ret < 0) {
-		dev_err(dev, "Cannot configure PPS-DB50 GPIO\n");
-		goto err_gpio_dir;
-	}
-	
+	for (i = 0; i < devdata->nr_channels; i++)
+		devdata->descs[i] = devdata->channels[i].gpio;
+	for (i = 0; i < devdata->nr_channels; i++)
+		dev_info(dev, "%s: %uHz, phase %uns, width %uns\n",
+			 devdata->channels[i].label, devdata->channels[i].rate_hz,
+			 devdata->channels[i].phase_ns, devdata->channels[i].width_ns);
+
 	pps_gen_calibrate(devdata);
-	hrtimer_init(&devdata->timer, CLOCK_REALTIME, HRTIMER_MODE_ABS);
+	INIT_WORK(&devdata->log_work, pps_gen_log_work);
+	/* Hard mode keeps the callback in hard IRQ context on PREEMPT_RT too. */
+	hrtimer_init(&devdata->timer, CLOCK_REALTIME, HRTIMER_MODE_ABS_HARD);
 	devdata->timer.function = hrtimer_callback;
 	hrtimer_start(&devdata->timer,
 		      pps_gen_first_timer_event(devdata),
-		      HRTIMER_MODE_ABS);
+		      HRTIMER_MODE_ABS_HARD);
 	return 0;
-
-err_gpio_dir:
-	devm_gpiod_put(dev, devdata->pps_gpio);
-	devm_gpiod_put(dev, devdata->pps_db50);
-err_gpio_get:
-err_dt:
-	devm_kfree(dev, devdata);
-err_alloc:
-	return ret;
 }
 
 static int pps_gen_gpio_remove(struct platform_device *pdev)
@@ -260,9 +795,13 @@ static int pps_gen_gpio_remove(struct platform_device *pdev)
 	struct device *dev = &pdev->dev;
 	struct pps_gen_gpio_devdata *devdata = platform_get_drvdata(pdev);
 
-	devm_gpiod_put(dev, devdata->pps_gpio);
-	devm_gpiod_put(dev, devdata->pps_db50);
 	hrtimer_cancel(&devdata->timer);
+	cancel_work_sync(&devdata->log_work);
+	dev_info(dev, "servo %s, lead %lldns, jitter %luns rms, write span max %lluns, %lu late\n",
+		 pps_gen_servo_state_names[devdata->servo_state],
+		 devdata->lead.out,
+		 (unsigned long)int_sqrt64(devdata->phase_ms),
+		 devdata->skew_max_ns, devdata->late_count);
 	return 0;
 }
 
@@ -278,6 +817,7 @@ static struct platform_driver pps_gen_gpio_driver = {
 		.name		= ADLINK_PPS_GEN_GPIO,
 		.owner		= THIS_MODULE,
 		.of_match_table = of_match_ptr(pps_gen_gpio_dt_ids),
+		.dev_groups	= pps_gen_gpio_groups,
 	},
 	.probe			= pps_gen_gpio_probe,
 	.remove			= pps_gen_gpio_remove,
@@ -298,8 +838,6 @@ static int __init pps_gen_gpio_init(void)
 
 static void __exit pps_gen_gpio_exit(void)
 {
-	pr_info("pps_gen_gpio_exit: hrtimer average latency is %ldns\n",
-		hrtimer_avg_latency);
 	platform_driver_unregister(&pps_gen_gpio_driver);
 }
 
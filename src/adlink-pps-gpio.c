@@ -1,54 +1,310 @@
+#include <linux/version.h>
 #include <linux/gpio.h>
 #include <linux/interrupt.h>
 #include <linux/module.h>
 #include <linux/platform_device.h>
 #include <linux/delay.h>
-#include <linux/of_gpio.h>
+#include <linux/pps_kernel.h>
+#include <linux/serdev.h>
+#include <linux/of.h>
+#include <linux/pci.h>
+#include <linux/ptp_clock_kernel.h>
+
+#include "adlink-gpio-event.h"
+#include "adlink-gte.h"
+#include "adlink-lib.h"
+#include "adlink-trace.h"
 
 #define DRIVER_NAME "adlink-pps-gpio"
-#define GPRMC_UART_TX "/dev/ttyTHS0"
-#define KERNEL_BUF_SIZE 128
+#define GPRMC_DRIVER_NAME "adlink-gprmc"
+#define GPRMC_BAUDRATE_DEF 115200
+#define GPRMC_MAX_LEN 96
+#define GPRMC_LATITUDE "25.04776"
+#define GPRMC_LONGITUDE "121.53185"
+
+/* UART carrying the NMEA stream, bound as a serdev client in DT */
+struct gprmc_port {
+	struct serdev_device *serdev;
+	struct list_head node;
+	u32 baudrate;
+};
+
+static LIST_HEAD(gprmc_ports);
+static DEFINE_MUTEX(gprmc_ports_lock);
+
+/* One complete NMEA sentence, rendered before the edge it belongs to */
+struct gprmc_sentence {
+	time64_t time;			/* second this sentence announces */
+	size_t len;
+	char buf[GPRMC_MAX_LEN];
+};
+
+/*
+ * What sets the PPS inputs apart, selected by the compatible. They all share
+ * the capture path below: hard IRQ timestamp, event device, PPS source and
+ * IRQ instrumentation.
+ */
+struct pps_gpio_variant {
+	const char *con_id;		/* <con_id>-gpios is the captured pin */
+	const char *evdev_prefix;	/* /dev/<evdev_prefix>-<label> */
+	bool pps_out;			/* may mirror the edge on "pps-out-gpios" */
+	bool gprmc;			/* may send GPRMC through "gprmc-uart" */
+	bool phc;			/* may name the PHC of "ptp-clock" as the pulse source */
+};
 
 struct pps_gpio_device_data {
+	struct device *dev;
+	const struct pps_gpio_variant *variant;
 	int irq;			/* IRQ used as PPS source */
 	struct gpio_desc *pps_in_desc;	/* GPIO port descriptors */
-	int pps_out_pinnum;
+	struct gpio_desc *pps_out_desc;
 	bool assert_falling_edge;
-	bool base_gpio;
-	time64_t time;
-	struct file *fptr;
+	bool capture_clear;
+	time64_t time;			/* second of the assert the thread handles */
+	struct adlink_evq *handoff;	/* assert edges, top half to thread */
+	struct adlink_gte gte;
+	struct adlink_irqstat *irqstat;
+	struct adlink_irqaff *irqaff;
+	struct adlink_ppsstat *ppsstat;
+	struct adlink_evdev *evdev;
+	struct pps_device *pps;		/* kernel PPS source */
+	struct pps_source_info info;
+	struct gprmc_port *gprmc_port;	/* NULL when no GPRMC output is configured */
+	struct gprmc_sentence gprmc[2];	/* double buffer, see _irq_bottom_handler */
+	unsigned int gprmc_next;	/* index of the sentence for the next edge */
+	unsigned long gprmc_misses;	/* edges that found no matching sentence */
+	unsigned long gprmc_errors;	/* sentences the UART did not fully accept */
+	u64 gprmc_count;		/* sentences written, for latency_avg_ns */
+	u64 gprmc_latency_last;		/* edge to UART handoff, in ns */
+	u64 gprmc_latency_min;
+	u64 gprmc_latency_max;
+	u64 gprmc_latency_sum;
+	int phc_index;			/* /dev/ptp<phc_index> emits the pulse, -1: none */
 };
 
-static int gprmc_serial_open(struct pps_gpio_device_data *data)
+static int gprmc_port_probe(struct serdev_device *serdev)
 {
-    data->fptr = filp_open(GPRMC_UART_TX, O_RDWR|O_NOCTTY|O_NONBLOCK, 0);
+	struct device *dev = &serdev->dev;
+	struct gprmc_port *port;
+	int ret;
 
-	if (!data->fptr) {
-		printk("Failed to open %s", GPRMC_UART_TX);
-		return -1;
-	}
+	port = devm_kzalloc(dev, sizeof(*port), GFP_KERNEL);
+	if (!port)
+		return -ENOMEM;
+
+	port->serdev = serdev;
+	if (device_property_read_u32(dev, "current-speed", &port->baudrate))
+		port->baudrate = GPRMC_BAUDRATE_DEF;
+
+	ret = devm_serdev_device_open(dev, serdev);
+	if (ret)
+		return dev_err_probe(dev, ret, "failed to open UART");
+
+	port->baudrate = serdev_device_set_baudrate(serdev, port->baudrate);
+	serdev_device_set_flow_control(serdev, false);
+	ret = serdev_device_set_parity(serdev, SERDEV_PARITY_NONE);
+	if (ret)
+		return dev_err_probe(dev, ret, "failed to set parity");
+
+	serdev_device_set_drvdata(serdev, port);
+
+	mutex_lock(&gprmc_ports_lock);
+	list_add_tail(&port->node, &gprmc_ports);
+	mutex_unlock(&gprmc_ports_lock);
+
+	dev_info(dev, "GPRMC output at %u baud\n", port->baudrate);
 
 	return 0;
 }
 
-static void gprmc_serial_close(struct pps_gpio_device_data *data)
+static void gprmc_port_remove(struct serdev_device *serdev)
 {
-	filp_close(data->fptr, NULL);
+	struct gprmc_port *port = serdev_device_get_drvdata(serdev);
+
+	mutex_lock(&gprmc_ports_lock);
+	list_del(&port->node);
+	mutex_unlock(&gprmc_ports_lock);
 }
 
-static int gprmc_serial_write(struct pps_gpio_device_data *data,
-		const unsigned char *buf, size_t count)
+static const struct of_device_id gprmc_port_dt_ids[] = {
+	{ .compatible = GPRMC_DRIVER_NAME, },
+	{ /* sentinel */ }
+};
+MODULE_DEVICE_TABLE(of, gprmc_port_dt_ids);
+
+static struct serdev_device_driver gprmc_port_driver = {
+	.probe		= gprmc_port_probe,
+	.remove		= gprmc_port_remove,
+	.driver		= {
+		.name	= GPRMC_DRIVER_NAME,
+		.of_match_table	= gprmc_port_dt_ids,
+	},
+};
+
+// Look up the port referenced by the "gprmc-uart" phandle
+static int gprmc_port_attach(struct device *dev)
+{
+	struct pps_gpio_device_data *data = dev_get_drvdata(dev);
+	struct device_node *np;
+	struct gprmc_port *port;
+
+	np = of_parse_phandle(dev->of_node, "gprmc-uart", 0);
+	if (!np)
+		return 0;
+
+	mutex_lock(&gprmc_ports_lock);
+	list_for_each_entry(port, &gprmc_ports, node) {
+		if (port->serdev->dev.of_node == np) {
+			data->gprmc_port = port;
+			break;
+		}
+	}
+	// Unbinding the UART client unbinds us first, so the port cannot go away under us
+	if (data->gprmc_port &&
+	    !device_link_add(dev, &data->gprmc_port->serdev->dev, DL_FLAG_AUTOREMOVE_CONSUMER))
+		data->gprmc_port = NULL;
+	mutex_unlock(&gprmc_ports_lock);
+	of_node_put(np);
+
+	if (!data->gprmc_port)
+		return -EPROBE_DEFER;
+
+	data->gprmc_latency_min = U64_MAX;
+
+	return 0;
+}
+
+static void gprmc_port_write(struct pps_gpio_device_data *data,
+		const struct gprmc_sentence *s, u64 edge_ns)
 {
 	int wlen;
-	loff_t pos = data->fptr->f_pos;
-	mm_segment_t oldfs;
-	oldfs = get_fs();
-	set_fs(KERNEL_DS);
-	
-	wlen = kernel_write(data->fptr, buf, count, &pos);
-	
-	set_fs(oldfs);
-	return wlen;
+	u64 latency;
+
+	wlen = serdev_device_write_buf(data->gprmc_port->serdev, s->buf, s->len);
+	latency = ktime_get_real_ns() - edge_ns;
+	trace_adlink_gprmc_write(s->time, s->len, wlen, latency);
+
+	if (wlen < 0 || (size_t)wlen != s->len) {
+		data->gprmc_errors++;
+		return;
+	}
+
+	data->gprmc_latency_last = latency;
+	data->gprmc_latency_min = min(data->gprmc_latency_min, latency);
+	data->gprmc_latency_max = max(data->gprmc_latency_max, latency);
+	data->gprmc_latency_sum += latency;
+	data->gprmc_count++;
+}
+
+struct gprmc_writer {
+	char *pos;
+	char *end;
+	u8 crc;
+};
+
+// Append a field and fold it into the checksum as it is copied
+static void gprmc_put(struct gprmc_writer *w, const char *str)
+{
+	while (*str && w->pos < w->end) {
+		w->crc ^= *str;
+		*w->pos++ = *str++;
+	}
+}
+
+static void gprmc_put_2d(struct gprmc_writer *w, unsigned int val)
+{
+	const char digits[3] = { '0' + (val / 10) % 10, '0' + val % 10, '\0' };
+
+	gprmc_put(w, digits);
+}
+
+static void gprmc_render(struct gprmc_sentence *s, time64_t time)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	struct gprmc_writer w = {
+		.pos = s->buf + 1,
+		// Leave room for "*XX\r\n"
+		.end = s->buf + GPRMC_MAX_LEN - 5,
+	};
+	struct tm tm;
+
+	time64_to_tm(time, sys_tz.tz_minuteswest * 60, &tm);
+
+	// Only the characters between '$' and '*' are part of the checksum
+	s->buf[0] = '$';
+	gprmc_put(&w, "GPRMC,");
+	gprmc_put_2d(&w, tm.tm_hour);
+	gprmc_put_2d(&w, tm.tm_min);
+	gprmc_put_2d(&w, tm.tm_sec);
+	gprmc_put(&w, ",A," GPRMC_LATITUDE ",N," GPRMC_LONGITUDE ",E,022.4,084.4,");
+	gprmc_put_2d(&w, tm.tm_mday);
+	gprmc_put_2d(&w, tm.tm_mon + 1);
+	gprmc_put_2d(&w, tm.tm_year % 100);
+	gprmc_put(&w, ",,A");
+
+	*w.pos++ = '*';
+	*w.pos++ = hex[w.crc >> 4];
+	*w.pos++ = hex[w.crc & 0xf];
+	*w.pos++ = '\r';
+	*w.pos++ = '\n';
+
+	s->len = w.pos - s->buf;
+	s->time = time;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 14, 0)
+static int phc_match(struct device *dev, void *data)
+#else
+static int phc_match(struct device *dev, const void *data)
+#endif
+{
+	return dev->class && !strcmp(dev->class->name, "ptp");
+}
+
+/*
+ * Find the PHC registered by the device that the "ptp-clock" phandle points
+ * to, e.g. the I210 PCI function. "ptp-clock-index" names /dev/ptpN directly
+ * where that device has no firmware node.
+ */
+static int phc_attach(struct device *dev)
+{
+	struct pps_gpio_device_data *data = dev_get_drvdata(dev);
+	struct fwnode_handle *fwnode;
+	struct device *owner, *phc;
+	u32 index;
+
+	data->phc_index = -1;
+	if (!device_property_read_u32(dev, "ptp-clock-index", &index)) {
+		data->phc_index = index;
+		goto out;
+	}
+
+	fwnode = fwnode_find_reference(dev_fwnode(dev), "ptp-clock", 0);
+	if (IS_ERR(fwnode))
+		return 0;
+
+	owner = bus_find_device_by_fwnode(&pci_bus_type, fwnode);
+	if (!owner)
+		owner = bus_find_device_by_fwnode(&platform_bus_type, fwnode);
+	fwnode_handle_put(fwnode);
+	if (!owner)
+		return -EPROBE_DEFER;
+
+	// The NIC driver registers the PHC as a child of its device
+	phc = device_find_child(owner, NULL, phc_match);
+	put_device(owner);
+	if (!phc)
+		return -EPROBE_DEFER;
+
+	data->phc_index = ptp_clock_index(dev_get_drvdata(phc));
+	put_device(phc);
+	if (data->phc_index < 0)
+		return -ENODEV;
+
+out:
+	dev_info(dev, "pulse source is PHC /dev/ptp%d\n", data->phc_index);
+
+	return 0;
 }
 
 // Top ISR, deal with the real-time tasks
@@ -56,59 +312,107 @@ static irqreturn_t _irq_top_handler(int irq, void *data)
 {
 	// Get the time stamp
 	struct pps_gpio_device_data *_data = data;
-	_data->time = ktime_get_real_seconds();
-	
-	// Pull high the PPS_OUT
-	if (gpio_is_valid(_data->pps_out_pinnum)) {
-		gpio_set_value(_data->pps_out_pinnum, 1);
+	struct pps_event_time ts;
+	struct adlink_gpio_event ev = { };
+	bool asserted = true;
+	bool hw_ts;
+	s64 age_ns;
+
+	// One snapshot of all clocks, the PPS core gets its REALTIME and MONOTONIC_RAW
+	adlink_event_clocks(&ev);
+	adlink_irqstat_hardirq(_data->irqstat);
+
+	// Prefer the GTE stamp, it does not include the IRQ entry latency
+	age_ns = adlink_gte_edge_age(&_data->gte, &ev.raw);
+	hw_ts = age_ns >= 0;
+	if (hw_ts)
+		adlink_event_backdate(&ev, age_ns);
+	ts.ts_real = ns_to_timespec64(ev.ns);
+#ifdef CONFIG_NTP_PPS
+	ts.ts_raw = ns_to_timespec64(ev.mono_raw_ns);
+#endif
+
+	// With capture-clear both edges trigger, so check which one this is
+	if (_data->capture_clear)
+		asserted = gpiod_get_value(_data->pps_in_desc) ^ _data->assert_falling_edge;
+	ev.flags = (asserted == _data->assert_falling_edge ? ADLINK_GPIO_EVENT_FALLING : 0) |
+		(hw_ts ? ADLINK_GPIO_EVENT_HWTS : 0);
+	ev.seq = adlink_evdev_push_event(_data->evdev, &ev);
+	trace_adlink_gpio_edge(irq, 0, ev.seq, ev.ns, ev.raw, ev.flags);
+	if (!asserted) {
+		pps_event(_data->pps, &ts, PPS_CAPTURECLEAR, NULL);
+		return IRQ_HANDLED;
 	}
-	
+
+	// Feed the PPS core (and hardpps when a kernel consumer is bound)
+	pps_event(_data->pps, &ts, PPS_CAPTUREASSERT, NULL);
+	// Queued, so that an edge the thread has not handled yet is not overwritten
+	adlink_evq_push(_data->handoff, &ev);
+
+	// Pull high the PPS_OUT
+	gpiod_set_value(_data->pps_out_desc, 1);
+
 	return IRQ_WAKE_THREAD; // schedule the bottom half
 }
 
+// The thread's part of one assert edge
+static void pps_gpio_assert(struct pps_gpio_device_data *_data, int irq,
+			    const struct adlink_gpio_event *ev)
+{
+	struct gprmc_sentence *gprmc;
+
+	if (ev->flags & ADLINK_GPIO_EVENT_OVERRUN)
+		dev_warn_ratelimited(_data->dev, "thread fell behind, edges before seq %llu lost\n",
+				     ev->seq);
+
+	// The edge marks the start of a second, round in case our clock runs slightly behind
+	_data->time = div_u64(ev->ns + NSEC_PER_SEC / 2, NSEC_PER_SEC);
+
+	if (_data->gprmc_port) {
+		// The sentence for this second was rendered during the previous one,
+		// only render here if an edge was missed or the clock has been stepped
+		gprmc = &_data->gprmc[_data->gprmc_next];
+		if (gprmc->time != _data->time) {
+			gprmc_render(gprmc, _data->time);
+			_data->gprmc_misses++;
+		}
+		_data->gprmc_next ^= 1;
+
+		// Write to UART TX port
+		gprmc_port_write(_data, gprmc, ev->ns);
+	}
+
+	trace_adlink_gpio_thread(irq, 0, ev->seq, ev->ns);
+	adlink_ppsstat_edge(_data->ppsstat, ev->ns);
+}
+
 // Bottom ISR, run the remain tasks after Top ISR
 static irqreturn_t _irq_bottom_handler(int irq, void *data)
 {
 	struct pps_gpio_device_data *_data = data;
-    char *gprmc_buf;
-    char *tmp_buf;
-    int CRC;
-    int i;
-    int sec, min, hour;
-
-	// Pull low the PPS_OUT after 100us
-	if (gpio_is_valid(_data->pps_out_pinnum)) {
+	struct adlink_gpio_event ev;
+	u64 start = adlink_irqstat_thread_begin(_data->irqstat);
+	bool handled = false;
+
+	adlink_irqaff_thread(_data->irqaff);
+
+	// Pull low the PPS_OUT after 100us, before the per-edge work can stretch the pulse
+	if (_data->pps_out_desc) {
 		udelay(100);
-		gpio_set_value(_data->pps_out_pinnum, 0);
-	}
-
-	// TODO: Do we need spin_lock here? PPS interrupt triggers once a second, will it be preempted?
-	sec = _data->time % 60;
-	min = (_data->time / 60) % 60;
-	hour = (_data->time / 3600) % 24 + (sys_tz.tz_minuteswest / 60);
-	printk("irq=%d, _irq_bottom_handler, %02d:%02d:%02d", irq, hour, min, sec);
-	
-    // Prepare GPRMC msg
-	gprmc_buf = kmalloc(KERNEL_BUF_SIZE, GFP_KERNEL | __GFP_ZERO);
-	tmp_buf = kmalloc(KERNEL_BUF_SIZE, GFP_KERNEL | __GFP_ZERO);
-	if (!gprmc_buf || !tmp_buf) {
-		printk("Failed to allocate memory.");
-	} else {
-        snprintf(tmp_buf, KERNEL_BUF_SIZE, "GPRMC,%02d%02d%02d,A,%s,N,%s,E,022.4,084.4,070423,,A", hour, min, sec, "25.04776", "121.53185");
-        for (i = 0; i < strlen(tmp_buf); i++) {
-            // XOR every character between '$' and '*'
-            CRC = CRC ^ tmp_buf[i];
-        }
-
-		snprintf(gprmc_buf, KERNEL_BUF_SIZE, "$%s*%02X\r\n", tmp_buf, CRC);
-		
-		// Write to UART TX port
-		gprmc_serial_write(data, gprmc_buf, strlen(gprmc_buf));
-		
-		kfree(gprmc_buf);
-		kfree(tmp_buf);
+		gpiod_set_value(_data->pps_out_desc, 0);
+	}
+
+	// Every assert since the last run, normally just one
+	while (adlink_evq_pop(_data->handoff, &ev)) {
+		pps_gpio_assert(_data, irq, &ev);
+		handled = true;
 	}
-	
+
+	// Prepare the next second while the UART is still busy with this one
+	if (handled && _data->gprmc_port)
+		gprmc_render(&_data->gprmc[_data->gprmc_next], _data->time + 1);
+
+	adlink_irqstat_thread_end(_data->irqstat, start);
 	return IRQ_HANDLED;
 }
 
@@ -116,26 +420,49 @@ static irqreturn_t _irq_bottom_handler(int irq, void *data)
 static int pps_gpio_setup(struct device *dev)
 {
 	struct pps_gpio_device_data *data = dev_get_drvdata(dev);
-	struct device_node *node = dev->of_node;
-	
+	const struct pps_gpio_variant *variant = data->variant;
+	int ret;
+
 	data->assert_falling_edge =
 		device_property_read_bool(dev, "assert-falling-edge");
-		
-	data->pps_in_desc = devm_gpiod_get(dev, "pps-in", GPIOD_IN);
+	data->capture_clear =
+		device_property_read_bool(dev, "capture-clear");
+
+	data->pps_in_desc = devm_gpiod_get(dev, variant->con_id, GPIOD_IN);
 	if (IS_ERR(data->pps_in_desc)) {
 		return dev_err_probe(dev, PTR_ERR(data->pps_in_desc),
-				     "failed to request pps-in-gpios");
+				     "failed to request %s-gpios", variant->con_id);
 	}
 
-	data->pps_out_pinnum = of_get_named_gpio(node, "pps-out-gpios", 0);
-	if (!gpio_is_valid(data->pps_out_pinnum)) {
-		dev_err(dev, "faiiled to request pps-out-gpios");
-		return -1;
+	ret = adlink_gte_setup(dev, &data->gte, data->pps_in_desc);
+	if (ret)
+		return ret;
+
+	data->phc_index = -1;
+	if (variant->phc) {
+		ret = phc_attach(dev);
+		if (ret)
+			return ret;
 	}
-	gpio_direction_output(data->pps_out_pinnum, 0);
 
-	// open GPRMC_UART_TX
-	gprmc_serial_open(data);
+	// Optional, PPS_OUT is written from the hard IRQ and must not sit on a sleeping chip
+	if (variant->pps_out) {
+		data->pps_out_desc = devm_gpiod_get_optional(dev, "pps-out", GPIOD_OUT_LOW);
+		if (IS_ERR(data->pps_out_desc)) {
+			return dev_err_probe(dev, PTR_ERR(data->pps_out_desc),
+					     "failed to request pps-out-gpios");
+		}
+	}
+
+	if (!variant->gprmc)
+		return 0;
+
+	// GPRMC output is optional, it needs a "gprmc-uart" phandle to an adlink-gprmc UART client
+	ret = gprmc_port_attach(dev);
+	if (ret)
+		return ret;
+	if (data->gprmc_port)
+		gprmc_render(&data->gprmc[data->gprmc_next], ktime_get_real_seconds() + 1);
 
 	return 0;
 }
@@ -146,9 +473,45 @@ get_irqf_trigger_flags(const struct pps_gpio_device_data *data)
 	unsigned long flags = data->assert_falling_edge ?
 		IRQF_TRIGGER_FALLING : IRQF_TRIGGER_RISING;
 
+	if (data->capture_clear)
+		flags |= data->assert_falling_edge ?
+			IRQF_TRIGGER_RISING : IRQF_TRIGGER_FALLING;
+
 	return flags;
 }
 
+static void pps_gpio_unregister_source(void *data)
+{
+	pps_unregister_source(data);
+}
+
+static int pps_gpio_register_source(struct device *dev)
+{
+	struct pps_gpio_device_data *data = dev_get_drvdata(dev);
+	int pps_default_params;
+
+	data->info.mode = PPS_CAPTUREASSERT | PPS_OFFSETASSERT |
+			  PPS_CANWAIT | PPS_TSFMT_TSPEC;
+	if (data->capture_clear)
+		data->info.mode |= PPS_CAPTURECLEAR | PPS_OFFSETCLEAR;
+	data->info.owner = THIS_MODULE;
+	strscpy(data->info.name, dev_name(dev), PPS_MAX_NAME_LEN);
+	// Tells PPS consumers which PHC the pulse belongs to, in /sys/class/pps/ppsN/path
+	if (data->phc_index >= 0)
+		snprintf(data->info.path, PPS_MAX_NAME_LEN, "/dev/ptp%d", data->phc_index);
+
+	pps_default_params = PPS_CAPTUREASSERT | PPS_OFFSETASSERT;
+	if (data->capture_clear)
+		pps_default_params |= PPS_CAPTURECLEAR | PPS_OFFSETCLEAR;
+
+	data->pps = pps_register_source(&data->info, pps_default_params);
+	if (IS_ERR_OR_NULL(data->pps))
+		return data->pps ? PTR_ERR(data->pps) : -EINVAL;
+
+	// Registered before the IRQ so that it is released after the IRQ is freed
+	return devm_add_action_or_reset(dev, pps_gpio_unregister_source, data->pps);
+}
+
 static int pps_gpio_probe(struct platform_device *pdev)
 {
 	struct pps_gpio_device_data *data;
@@ -160,7 +523,13 @@ static int pps_gpio_probe(struct platform_device *pdev)
 	if (!data)
 		return -ENOMEM;
 
+	// DT compatible, or the platform device name without DT
+	data->variant = device_get_match_data(dev);
+	if (!data->variant)
+		data->variant = (const void *)platform_get_device_id(pdev)->driver_data;
+
 	dev_set_drvdata(dev, data);
+	data->dev = dev;
 
 	/* GPIO setup */
 	ret = pps_gpio_setup(dev);
@@ -177,20 +546,61 @@ static int pps_gpio_probe(struct platform_device *pdev)
 	}
 	data->irq = ret;
 
-	if (data->base_gpio) {		
-		// base-gpio doesn't need an IRQ Top handler because the interrupt occurs on PCA953x
-		ret = devm_request_threaded_irq(dev, data->irq, NULL, _irq_bottom_handler,
-			get_irqf_trigger_flags(data), DRIVER_NAME, data);
-	} else {
-		ret = devm_request_threaded_irq(dev, data->irq, _irq_top_handler, _irq_bottom_handler,
-			get_irqf_trigger_flags(data), DRIVER_NAME, data);
+	/* Latency instrumentation */
+	data->irqstat = devm_adlink_irqstat_create(dev);
+	if (IS_ERR(data->irqstat)) {
+		dev_err(dev, "failed to create IRQ statistics\n");
+		return PTR_ERR(data->irqstat);
+	}
+
+	/* IRQ CPU and thread priority */
+	data->irqaff = devm_adlink_irqaff_create(dev);
+	if (IS_ERR(data->irqaff)) {
+		dev_err(dev, "failed to set up IRQ affinity\n");
+		return PTR_ERR(data->irqaff);
+	}
+
+	/* Signal quality statistics */
+	data->ppsstat = devm_adlink_ppsstat_create(dev);
+	if (IS_ERR(data->ppsstat)) {
+		dev_err(dev, "failed to create PPS statistics\n");
+		return PTR_ERR(data->ppsstat);
+	}
+
+	/* Thread handoff setup */
+	data->handoff = devm_adlink_evq_create(dev, 0);
+	if (IS_ERR(data->handoff)) {
+		dev_err(dev, "failed to create event queue\n");
+		return PTR_ERR(data->handoff);
+	}
+
+	/* Event device setup */
+	data->evdev = devm_adlink_evdev_create(dev, data->variant->evdev_prefix);
+	if (IS_ERR(data->evdev)) {
+		dev_err(dev, "failed to create event device\n");
+		return PTR_ERR(data->evdev);
+	}
+
+	/* PPS source setup */
+	ret = pps_gpio_register_source(dev);
+	if (ret) {
+		dev_err(dev, "failed to register IRQ %d as PPS source: %d\n", data->irq, ret);
+		return ret;
 	}
+
+	ret = devm_request_threaded_irq(dev, data->irq, _irq_top_handler, _irq_bottom_handler,
+		get_irqf_trigger_flags(data), dev_name(dev), data);
 	if (ret) {
 		dev_err(dev, "failed to acquire IRQ %d, ret=%d\n", data->irq, ret);
 		return -EINVAL;
 	}
 
-	dev_info(dev, "Driver %s has been successfully probed\n", DRIVER_NAME);
+	ret = devm_adlink_irqaff_add_irq(dev, data->irqaff, data->irq);
+	if (ret)
+		return ret;
+
+	dev_info(dev, "Driver %s has been successfully probed as PPS source %d\n",
+		 dev_driver_string(dev), data->pps->id);
 
 	return 0;
 }
@@ -199,31 +609,179 @@ static int pps_gpio_remove(struct platform_device *pdev)
 {
 	struct pps_gpio_device_data *data = platform_get_drvdata(pdev);
 
-	dev_info(&pdev->dev, "removed IRQ %d as PPS source\n", data->irq);
-	
-	// close GPRMC_UART_TX
-	gprmc_serial_close(data);
-	
+	dev_info(&pdev->dev, "removed IRQ %d as PPS source, %llu overruns, %lu GPRMC sentences rendered late\n",
+		 data->irq, adlink_evdev_overruns(data->evdev), data->gprmc_misses);
+
 	return 0;
 }
 
+static ssize_t latency_last_ns_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	struct pps_gpio_device_data *data = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%llu\n", data->gprmc_latency_last);
+}
+static DEVICE_ATTR_RO(latency_last_ns);
+
+static ssize_t latency_min_ns_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct pps_gpio_device_data *data = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%llu\n", data->gprmc_count ? data->gprmc_latency_min : 0);
+}
+static DEVICE_ATTR_RO(latency_min_ns);
+
+static ssize_t latency_max_ns_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct pps_gpio_device_data *data = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%llu\n", data->gprmc_latency_max);
+}
+static DEVICE_ATTR_RO(latency_max_ns);
+
+static ssize_t latency_avg_ns_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct pps_gpio_device_data *data = dev_get_drvdata(dev);
+	u64 count = data->gprmc_count;
+
+	return sprintf(buf, "%llu\n", count ? div64_u64(data->gprmc_latency_sum, count) : 0);
+}
+static DEVICE_ATTR_RO(latency_avg_ns);
+
+static ssize_t sentences_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct pps_gpio_device_data *data = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%llu\n", data->gprmc_count);
+}
+static DEVICE_ATTR_RO(sentences);
+
+static ssize_t late_renders_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct pps_gpio_device_data *data = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%lu\n", data->gprmc_misses);
+}
+static DEVICE_ATTR_RO(late_renders);
+
+static ssize_t write_errors_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct pps_gpio_device_data *data = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%lu\n", data->gprmc_errors);
+}
+static DEVICE_ATTR_RO(write_errors);
+
+/* Edge to UART handoff latency of the GPRMC output, under <device>/gprmc/ */
+static struct attribute *gprmc_attrs[] = {
+	&dev_attr_latency_last_ns.attr,
+	&dev_attr_latency_min_ns.attr,
+	&dev_attr_latency_max_ns.attr,
+	&dev_attr_latency_avg_ns.attr,
+	&dev_attr_sentences.attr,
+	&dev_attr_late_renders.attr,
+	&dev_attr_write_errors.attr,
+	NULL,
+};
+
+// Only the variants that can send GPRMC have the group
+static umode_t gprmc_attr_visible(struct kobject *kobj, struct attribute *attr, int n)
+{
+	struct pps_gpio_device_data *data = dev_get_drvdata(kobj_to_dev(kobj));
+
+	return data->variant->gprmc ? attr->mode : 0;
+}
+
+static const struct attribute_group gprmc_attr_group = {
+	.name = "gprmc",
+	.attrs = gprmc_attrs,
+	.is_visible = gprmc_attr_visible,
+};
+
+static const struct attribute_group *pps_gpio_groups[] = {
+	&gprmc_attr_group,
+	NULL,
+};
+
+/* PPS-in from the FPGA, may drive PPS_OUT and send GPRMC */
+static const struct pps_gpio_variant pps_gpio_variant = {
+	.con_id		= "pps-in",
+	.evdev_prefix	= "adlink-pps",
+	.pps_out	= true,
+	.gprmc		= true,
+};
+
+/* PPS-MCU from the FPGA */
+static const struct pps_gpio_variant pps_mcu_variant = {
+	.con_id		= "pps-mcu",
+	.evdev_prefix	= "adlink-pps-mcu",
+};
+
+/* PPS of the I210 PTP clock, may name that PHC */
+static const struct pps_gpio_variant pps_i210_variant = {
+	.con_id		= "pps-in",
+	.evdev_prefix	= "adlink-pps-i210",
+	.phc		= true,
+};
+
 static const struct of_device_id pps_gpio_dt_ids[] = {
-	{ .compatible = DRIVER_NAME, },
+	{ .compatible = "adlink-pps-gpio", .data = &pps_gpio_variant },
+	{ .compatible = "adlink-pps-mcu", .data = &pps_mcu_variant },
+	{ .compatible = "adlink-pps-i210", .data = &pps_i210_variant },
 	{ /* sentinel */ }
 };
 MODULE_DEVICE_TABLE(of, pps_gpio_dt_ids);
 
+static const struct platform_device_id pps_gpio_ids[] = {
+	{ "adlink-pps-gpio", (kernel_ulong_t)&pps_gpio_variant },
+	{ "adlink-pps-mcu", (kernel_ulong_t)&pps_mcu_variant },
+	{ "adlink-pps-i210", (kernel_ulong_t)&pps_i210_variant },
+	{ /* sentinel */ }
+};
+MODULE_DEVICE_TABLE(platform, pps_gpio_ids);
+
 static struct platform_driver pps_gpio_driver = {
 	.probe		= pps_gpio_probe,
 	.remove		= pps_gpio_remove,
+	.id_table	= pps_gpio_ids,
 	.driver		= {
 		.name	= DRIVER_NAME,
 		.of_match_table	= pps_gpio_dt_ids,
+		.dev_groups	= pps_gpio_groups,
 	},
 };
 
-module_platform_driver(pps_gpio_driver);
+static int __init pps_gpio_init(void)
+{
+	int ret;
+
+	ret = serdev_device_driver_register(&gprmc_port_driver);
+	if (ret)
+		return ret;
+
+	ret = platform_driver_register(&pps_gpio_driver);
+	if (ret)
+		serdev_device_driver_unregister(&gprmc_port_driver);
+
+	return ret;
+}
+
+static void __exit pps_gpio_exit(void)
+{
+	platform_driver_unregister(&pps_gpio_driver);
+	serdev_device_driver_unregister(&gprmc_port_driver);
+}
+
+module_init(pps_gpio_init);
+module_exit(pps_gpio_exit);
 MODULE_AUTHOR("Ting Chang <ting.chang@adlinktech.com>");
-MODULE_DESCRIPTION("Receive FPGA PPS signal through GPIO pin");
+MODULE_DESCRIPTION("Receive FPGA, MCU and I210 PPS signals through GPIO pins");
 MODULE_LICENSE("GPL");
 MODULE_VERSION("1.0.0");
\ No newline at end of file
@@ -0,0 +1,313 @@
+/*
+ * adlink-ppsstat.c -- online quality statistics of a PPS input
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/device.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/math64.h>
+#include <linux/kernel.h>
+
+#include "adlink-lib.h"
+#include "adlink-lib-priv.h"
+
+/* Allan deviation taus in seconds, the history holds 2 * the largest + 1 phases */
+static const u32 adlink_ppsstat_taus[] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000 };
+#define ADLINK_PPSSTAT_NR_TAUS	ARRAY_SIZE(adlink_ppsstat_taus)
+#define ADLINK_PPSSTAT_HISTORY	(2 * 1000 + 1)
+
+#define ADLINK_PPSSTAT_EWMA	64	/* time constant of the running means, in edges */
+#define ADLINK_PPSSTAT_FREQ_SPAN	64	/* seconds the frequency is taken over */
+#define ADLINK_PPSSTAT_DRIFT_SPAN	500	/* seconds per half of the drift estimate */
+
+struct adlink_ppsstat_ewma {
+	s64 mean;			/* ns << 8 */
+	u64 var;			/* ns^2 */
+	bool init;
+};
+
+struct adlink_ppsstat {
+	struct mutex lock;		/* edges vs sysfs */
+
+	/* Unwrapped phase vs the system second, one per edge without gaps */
+	s64 *phase;			/* [ADLINK_PPSSTAT_HISTORY] ring */
+	unsigned int head;
+	unsigned int fill;
+	u64 last_ns;			/* previous edge, 0: none */
+
+	s64 offset_last;
+	struct adlink_ppsstat_ewma offset;
+	struct adlink_ppsstat_ewma period;	/* period - 1s */
+	u64 period_err_max;
+
+	/* Overlapping Allan variance, sum of squared second differences per tau */
+	u64 adev_sum[ADLINK_PPSSTAT_NR_TAUS];
+	u64 adev_terms[ADLINK_PPSSTAT_NR_TAUS];
+
+	u64 edges;
+	u64 gaps;			/* missed or extra edges, the history restarts */
+};
+
+static void adlink_ppsstat_devres_release(struct device *dev, void *res)
+{
+}
+
+static struct adlink_ppsstat *to_adlink_ppsstat(struct device *dev)
+{
+	return devres_find(dev, adlink_ppsstat_devres_release, NULL, NULL);
+}
+
+static void adlink_ppsstat_ewma_add(struct adlink_ppsstat_ewma *e, s64 x)
+{
+	s64 dev;
+
+	if (!e->init) {
+		e->mean = x * 256;
+		e->var = 0;
+		e->init = true;
+		return;
+	}
+
+	e->mean += div_s64(x * 256 - e->mean, ADLINK_PPSSTAT_EWMA);
+	dev = x - div_s64(e->mean, 256);
+	e->var += div_s64((s64)(dev * dev) - (s64)e->var, ADLINK_PPSSTAT_EWMA);
+}
+
+// Phase @back edges before the newest one, caller checks fill
+static s64 adlink_ppsstat_phase(struct adlink_ppsstat *ps, unsigned int back)
+{
+	return ps->phase[(ps->head + ADLINK_PPSSTAT_HISTORY - 1 - back) % ADLINK_PPSSTAT_HISTORY];
+}
+
+static void adlink_ppsstat_reset(struct adlink_ppsstat *ps)
+{
+	ps->head = 0;
+	ps->fill = 0;
+	ps->last_ns = 0;
+	ps->offset_last = 0;
+	memset(&ps->offset, 0, sizeof(ps->offset));
+	memset(&ps->period, 0, sizeof(ps->period));
+	ps->period_err_max = 0;
+	memset(ps->adev_sum, 0, sizeof(ps->adev_sum));
+	memset(ps->adev_terms, 0, sizeof(ps->adev_terms));
+	ps->edges = 0;
+	ps->gaps = 0;
+}
+
+void adlink_ppsstat_edge(struct adlink_ppsstat *ps, u64 ns)
+{
+	s64 offset, err, x, d;
+	unsigned int i, m;
+	u32 rem;
+
+	if (IS_ERR_OR_NULL(ps))
+		return;
+
+	// Offset to the nearest system second
+	div_u64_rem(ns, NSEC_PER_SEC, &rem);
+	offset = rem < NSEC_PER_SEC / 2 ? rem : (s64)rem - NSEC_PER_SEC;
+
+	mutex_lock(&ps->lock);
+
+	ps->edges++;
+	ps->offset_last = offset;
+	adlink_ppsstat_ewma_add(&ps->offset, offset);
+
+	err = ps->last_ns ? (s64)(ns - ps->last_ns) - NSEC_PER_SEC : 0;
+	ps->last_ns = ns;
+	if (abs(err) >= NSEC_PER_SEC / 2) {
+		// Not one second apart, the phases no longer line up
+		ps->gaps++;
+		ps->fill = 0;
+	} else if (ps->fill) {
+		adlink_ppsstat_ewma_add(&ps->period, err);
+		ps->period_err_max = max_t(u64, ps->period_err_max, abs(err));
+	}
+
+	// Unwrapped, so that it runs on across the +-0.5s boundary
+	x = ps->fill ? adlink_ppsstat_phase(ps, 0) + err : offset;
+	ps->phase[ps->head] = x;
+	ps->head = (ps->head + 1) % ADLINK_PPSSTAT_HISTORY;
+	ps->fill = min(ps->fill + 1, (unsigned int)ADLINK_PPSSTAT_HISTORY);
+
+	for (i = 0; i < ADLINK_PPSSTAT_NR_TAUS; i++) {
+		m = adlink_ppsstat_taus[i];
+		if (ps->fill <= 2 * m)
+			break;
+		d = x - 2 * adlink_ppsstat_phase(ps, m) + adlink_ppsstat_phase(ps, 2 * m);
+		ps->adev_sum[i] += d * d;
+		ps->adev_terms[i]++;
+	}
+
+	mutex_unlock(&ps->lock);
+}
+EXPORT_SYMBOL_GPL(adlink_ppsstat_edge);
+
+/* "<last> <mean> <stddev>" of the edge vs the nearest system second */
+static ssize_t offset_ns_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct adlink_ppsstat *ps = to_adlink_ppsstat(dev);
+	ssize_t ret;
+
+	mutex_lock(&ps->lock);
+	ret = sprintf(buf, "%lld %lld %llu\n", ps->offset_last,
+		      div_s64(ps->offset.mean, 256), int_sqrt64(ps->offset.var));
+	mutex_unlock(&ps->lock);
+
+	return ret;
+}
+static DEVICE_ATTR_RO(offset_ns);
+
+/* "<stddev> <max>" of the period against one second */
+static ssize_t jitter_ns_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct adlink_ppsstat *ps = to_adlink_ppsstat(dev);
+	ssize_t ret;
+
+	mutex_lock(&ps->lock);
+	ret = sprintf(buf, "%llu %llu\n", int_sqrt64(ps->period.var), ps->period_err_max);
+	mutex_unlock(&ps->lock);
+
+	return ret;
+}
+static DEVICE_ATTR_RO(jitter_ns);
+
+/* Rate of the PPS against the system clock over the last minute, 1ns/s is 1ppb */
+static ssize_t freq_ppb_show(struct device *dev,
+			     struct device_attribute *attr, char *buf)
+{
+	struct adlink_ppsstat *ps = to_adlink_ppsstat(dev);
+	unsigned int k;
+	s64 freq = 0;
+
+	mutex_lock(&ps->lock);
+	k = min(ps->fill ? ps->fill - 1 : 0, (unsigned int)ADLINK_PPSSTAT_FREQ_SPAN);
+	if (k)
+		freq = div_s64(adlink_ppsstat_phase(ps, 0) - adlink_ppsstat_phase(ps, k), k);
+	mutex_unlock(&ps->lock);
+
+	return sprintf(buf, "%lld\n", freq);
+}
+static DEVICE_ATTR_RO(freq_ppb);
+
+/* Change of the PPS rate per hour, the last 500s against the 500s before */
+static ssize_t drift_ppb_per_hour_show(struct device *dev,
+				       struct device_attribute *attr, char *buf)
+{
+	struct adlink_ppsstat *ps = to_adlink_ppsstat(dev);
+	unsigned int k;
+	s64 drift = 0;
+
+	mutex_lock(&ps->lock);
+	k = min(ps->fill ? (ps->fill - 1) / 2 : 0, (unsigned int)ADLINK_PPSSTAT_DRIFT_SPAN);
+	if (k)
+		drift = div_s64((adlink_ppsstat_phase(ps, 0) - 2 * adlink_ppsstat_phase(ps, k) +
+				 adlink_ppsstat_phase(ps, 2 * k)) * 3600, (s64)k * k);
+	mutex_unlock(&ps->lock);
+
+	return sprintf(buf, "%lld\n", drift);
+}
+static DEVICE_ATTR_RO(drift_ppb_per_hour);
+
+/*
+ * One "<tau> <adev> <terms>" line per tau, adev in units of 1e-12. A tau
+ * shows up once 2 * tau + 1 edges in a row have been seen.
+ */
+static ssize_t allan_deviation_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	struct adlink_ppsstat *ps = to_adlink_ppsstat(dev);
+	unsigned int i;
+	ssize_t len = 0;
+	u64 avar;
+
+	mutex_lock(&ps->lock);
+	for (i = 0; i < ADLINK_PPSSTAT_NR_TAUS && ps->adev_terms[i]; i++) {
+		// sigma = sqrt(sum / (2 * terms)) / tau, in ns per s, 1e3 of the output unit
+		avar = div64_u64(ps->adev_sum[i], 2 * ps->adev_terms[i]);
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%u %llu %llu\n",
+				 adlink_ppsstat_taus[i],
+				 div_u64(avar < U64_MAX / 1000000 ? int_sqrt64(avar * 1000000) :
+					 int_sqrt64(avar) * 1000, adlink_ppsstat_taus[i]),
+				 ps->adev_terms[i]);
+	}
+	mutex_unlock(&ps->lock);
+
+	return len;
+}
+static DEVICE_ATTR_RO(allan_deviation);
+
+/* "<edges> <gaps>", writing anything restarts all statistics */
+static ssize_t edges_show(struct device *dev,
+			  struct device_attribute *attr, char *buf)
+{
+	struct adlink_ppsstat *ps = to_adlink_ppsstat(dev);
+	ssize_t ret;
+
+	mutex_lock(&ps->lock);
+	ret = sprintf(buf, "%llu %llu\n", ps->edges, ps->gaps);
+	mutex_unlock(&ps->lock);
+
+	return ret;
+}
+
+static ssize_t edges_store(struct device *dev,
+			   struct device_attribute *attr,
+			   const char *buf, size_t count)
+{
+	struct adlink_ppsstat *ps = to_adlink_ppsstat(dev);
+
+	mutex_lock(&ps->lock);
+	adlink_ppsstat_reset(ps);
+	mutex_unlock(&ps->lock);
+
+	return count;
+}
+static DEVICE_ATTR_RW(edges);
+
+static struct attribute *adlink_ppsstat_attrs[] = {
+	&dev_attr_offset_ns.attr,
+	&dev_attr_jitter_ns.attr,
+	&dev_attr_freq_ppb.attr,
+	&dev_attr_drift_ppb_per_hour.attr,
+	&dev_attr_allan_deviation.attr,
+	&dev_attr_edges.attr,
+	NULL,
+};
+
+/* Under <device>/quality/ */
+static const struct attribute_group adlink_ppsstat_group = {
+	.name = "quality",
+	.attrs = adlink_ppsstat_attrs,
+};
+
+struct adlink_ppsstat *devm_adlink_ppsstat_create(struct device *dev)
+{
+	struct adlink_ppsstat *ps;
+	int ret;
+
+	ps = devres_alloc(adlink_ppsstat_devres_release, sizeof(*ps), GFP_KERNEL);
+	if (!ps)
+		return ERR_PTR(-ENOMEM);
+	devres_add(dev, ps);
+
+	mutex_init(&ps->lock);
+	ps->phase = devm_kcalloc(dev, ADLINK_PPSSTAT_HISTORY, sizeof(*ps->phase), GFP_KERNEL);
+	if (!ps->phase)
+		return ERR_PTR(-ENOMEM);
+
+	ret = devm_device_add_group(dev, &adlink_ppsstat_group);
+	if (ret)
+		return ERR_PTR(ret);
+
+	return ps;
+}
+EXPORT_SYMBOL_GPL(devm_adlink_ppsstat_create);
@@ -0,0 +1,159 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Tracepoints of the ADLINK GPIO drivers, defined in adlink-gpio-lib.ko.
+ *
+ *	echo 1 > /sys/kernel/tracing/events/adlink_gpio/enable
+ *	perf record -e 'adlink_gpio:*' -a
+ *
+ * A disabled tracepoint costs a patched-out branch, so they are emitted for
+ * every edge, also from hard IRQ context.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM adlink_gpio
+
+#if !defined(_ADLINK_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _ADLINK_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* An edge was captured, from the top half */
+TRACE_EVENT(adlink_gpio_edge,
+
+	TP_PROTO(int irq, u32 channel, u64 seq, u64 ns, u64 raw, u32 flags),
+
+	TP_ARGS(irq, channel, seq, ns, raw, flags),
+
+	TP_STRUCT__entry(
+		__field(int, irq)
+		__field(u32, channel)
+		__field(u64, seq)
+		__field(u64, ns)
+		__field(u64, raw)
+		__field(u32, flags)
+	),
+
+	TP_fast_assign(
+		__entry->irq = irq;
+		__entry->channel = channel;
+		__entry->seq = seq;
+		__entry->ns = ns;
+		__entry->raw = raw;
+		__entry->flags = flags;
+	),
+
+	TP_printk("irq=%d ch=%u seq=%llu ns=%llu raw=%llu flags=%#x",
+		  __entry->irq, __entry->channel, __entry->seq, __entry->ns,
+		  __entry->raw, __entry->flags)
+);
+
+/* The threaded half has handled the edge @seq */
+TRACE_EVENT(adlink_gpio_thread,
+
+	TP_PROTO(int irq, u32 channel, u64 seq, u64 ns),
+
+	TP_ARGS(irq, channel, seq, ns),
+
+	TP_STRUCT__entry(
+		__field(int, irq)
+		__field(u32, channel)
+		__field(u64, seq)
+		__field(u64, ns)
+	),
+
+	TP_fast_assign(
+		__entry->irq = irq;
+		__entry->channel = channel;
+		__entry->seq = seq;
+		__entry->ns = ns;
+	),
+
+	TP_printk("irq=%d ch=%u seq=%llu ns=%llu",
+		  __entry->irq, __entry->channel, __entry->seq, __entry->ns)
+);
+
+/* A GPRMC sentence for @time was handed to the UART */
+TRACE_EVENT(adlink_gprmc_write,
+
+	TP_PROTO(s64 time, int len, int ret, u64 latency_ns),
+
+	TP_ARGS(time, len, ret, latency_ns),
+
+	TP_STRUCT__entry(
+		__field(s64, time)
+		__field(int, len)
+		__field(int, ret)
+		__field(u64, latency_ns)
+	),
+
+	TP_fast_assign(
+		__entry->time = time;
+		__entry->len = len;
+		__entry->ret = ret;
+		__entry->latency_ns = latency_ns;
+	),
+
+	TP_printk("time=%lld len=%d ret=%d latency_ns=%llu",
+		  __entry->time, __entry->len, __entry->ret, __entry->latency_ns)
+);
+
+/* The PPS generator wrote an edge, times in CLOCK_REALTIME ns */
+TRACE_EVENT(adlink_pps_gen_edge,
+
+	TP_PROTO(unsigned int channel, bool assert, s64 target_ns, s64 write_ns,
+		 s64 irqoff_ns),
+
+	TP_ARGS(channel, assert, target_ns, write_ns, irqoff_ns),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, channel)
+		__field(bool, assert)
+		__field(s64, target_ns)
+		__field(s64, write_ns)
+		__field(s64, irqoff_ns)
+	),
+
+	TP_fast_assign(
+		__entry->channel = channel;
+		__entry->assert = assert;
+		__entry->target_ns = target_ns;
+		__entry->write_ns = write_ns;
+		__entry->irqoff_ns = irqoff_ns;
+	),
+
+	TP_printk("channel=%u %s target=%lld write=%lld irqoff_ns=%lld",
+		  __entry->channel, __entry->assert ? "assert" : "deassert", __entry->target_ns,
+		  __entry->write_ns, __entry->irqoff_ns)
+);
+
+/* The PPS generator timer fired after an assert edge, the pulse is skipped */
+TRACE_EVENT(adlink_pps_gen_late,
+
+	TP_PROTO(unsigned int channel, s64 target_ns, s64 expire_ns),
+
+	TP_ARGS(channel, target_ns, expire_ns),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, channel)
+		__field(s64, target_ns)
+		__field(s64, expire_ns)
+	),
+
+	TP_fast_assign(
+		__entry->channel = channel;
+		__entry->target_ns = target_ns;
+		__entry->expire_ns = expire_ns;
+	),
+
+	TP_printk("channel=%u target=%lld expire=%lld", __entry->channel, __entry->target_ns,
+		  __entry->expire_ns)
+);
+
+#endif /* _ADLINK_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE adlink-trace
+#include <trace/define_trace.h>
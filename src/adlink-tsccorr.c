@@ -0,0 +1,435 @@
+/*
+ * adlink-tsccorr.c -- TSC to system clock correlation for hardware timestamps
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/version.h>
+#include <linux/device.h>
+#include <linux/workqueue.h>
+#include <linux/timekeeping.h>
+#include <linux/clocksource.h>
+#include <linux/seqlock.h>
+#include <linux/mutex.h>
+#include <linux/math64.h>
+#include <linux/irqflags.h>
+
+#include "adlink-lib.h"
+#include "adlink-lib-priv.h"
+
+#ifdef CONFIG_ARM64
+#include <asm/arch_timer.h>
+#endif
+
+#define ADLINK_TSCCORR_WINDOW		16	/* samples in the regression */
+#define ADLINK_TSCCORR_READS		8	/* bracketed reads per sample, the tightest is kept */
+#define ADLINK_TSCCORR_PERIOD_MIN_MS	10
+#define ADLINK_TSCCORR_PERIOD_MAX_MS	10000
+#define ADLINK_TSCCORR_MAX_PPB		1000000	/* beyond it the fit is garbage */
+#define ADLINK_TSCCORR_RESET_NS		(1000 * NSEC_PER_USEC)	/* prediction error that restarts the window */
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0)
+#define read_seqcount_latch_retry(s, start) read_seqcount_retry(&(s)->seqcount, start)
+#endif
+
+/* What adlink_tsccorr_convert() needs, published through the latch */
+struct adlink_tsccorr_params {
+	u64 tsc;			/* fit origin, the newest sample */
+	u64 mono_ns;			/* fitted CLOCK_MONOTONIC at tsc */
+	s64 real_off_ns;		/* CLOCK_REALTIME - CLOCK_MONOTONIC */
+	u32 mult;			/* ticks to ns, drift corrected, 0: no fit yet */
+	u32 shift;
+};
+
+struct adlink_tsccorr_sample {
+	u64 tsc;
+	u64 mono_ns;
+};
+
+struct adlink_tsccorr {
+	struct device *dev;
+
+	/* Lock-free reader side */
+	seqcount_latch_t latch;
+	struct adlink_tsccorr_params params[2];
+
+	/* Sampling, all of it under lock */
+	struct mutex lock;
+	struct delayed_work work;
+	unsigned int period_ms;
+	u32 mult;			/* nominal ticks to ns */
+	u32 shift;
+	struct adlink_tsccorr_sample win[ADLINK_TSCCORR_WINDOW];
+	unsigned int head;
+	unsigned int count;
+
+	/* Reported in sysfs */
+	s64 freq_ppb;			/* counter rate error vs CLOCK_MONOTONIC */
+	u64 residual_rms_ns;		/* of the window against the fit */
+	u64 residual_max_ns;
+	s64 prediction_ns;		/* newest sample against the previous fit */
+	u64 read_skew_ns;		/* half the bracket of the newest sample */
+	u64 samples;
+	u64 resets;
+};
+
+#ifdef CONFIG_ARM64
+/* The arch counter is the TSC that GTE stamps with */
+static u64 adlink_tsccorr_counter(void)
+{
+	return arch_timer_read_counter();
+}
+
+static u32 adlink_tsccorr_rate(void)
+{
+	return arch_timer_get_rate();
+}
+#else
+// No TSC, correlate CLOCK_MONOTONIC_RAW so that the code still runs
+static u64 adlink_tsccorr_counter(void)
+{
+	return ktime_get_raw_ns();
+}
+
+static u32 adlink_tsccorr_rate(void)
+{
+	return NSEC_PER_SEC;
+}
+#endif
+
+static s64 adlink_tsccorr_ticks_to_ns(s64 ticks, u32 mult, u32 shift)
+{
+	if (ticks >= 0)
+		return mul_u64_u32_shr(ticks, mult, shift);
+
+	return -(s64)mul_u64_u32_shr(-ticks, mult, shift);
+}
+
+static void adlink_tsccorr_devres_release(struct device *dev, void *res)
+{
+}
+
+static struct adlink_tsccorr *to_adlink_tsccorr(struct device *dev)
+{
+	return devres_find(dev, adlink_tsccorr_devres_release, NULL, NULL);
+}
+
+static void adlink_tsccorr_read_params(struct adlink_tsccorr *tc,
+				       struct adlink_tsccorr_params *p)
+{
+	unsigned int seq;
+
+	do {
+		seq = raw_read_seqcount_latch(&tc->latch);
+		*p = tc->params[seq & 1];
+	} while (read_seqcount_latch_retry(&tc->latch, seq));
+}
+
+bool adlink_tsccorr_convert(struct adlink_tsccorr *tc, u64 tsc, u64 *real_ns, u64 *mono_ns)
+{
+	struct adlink_tsccorr_params p;
+	u64 mono;
+
+	if (IS_ERR_OR_NULL(tc))
+		return false;
+
+	adlink_tsccorr_read_params(tc, &p);
+	if (!p.mult)
+		return false;
+
+	mono = p.mono_ns + adlink_tsccorr_ticks_to_ns(tsc - p.tsc, p.mult, p.shift);
+	if (mono_ns)
+		*mono_ns = mono;
+	if (real_ns)
+		*real_ns = mono + p.real_off_ns;
+
+	return true;
+}
+EXPORT_SYMBOL_GPL(adlink_tsccorr_convert);
+
+/*
+ * Bracket CLOCK_MONOTONIC with two counter reads and keep the tightest of a
+ * few tries. The midpoint is the counter value of the clock read, off by at
+ * most half the bracket.
+ */
+static u64 adlink_tsccorr_read(struct adlink_tsccorr_sample *s)
+{
+	u64 best = U64_MAX;
+	u64 t0, t1, mono;
+	unsigned long flags;
+	int i;
+
+	for (i = 0; i < ADLINK_TSCCORR_READS; i++) {
+		local_irq_save(flags);
+		t0 = adlink_tsccorr_counter();
+		mono = ktime_get_ns();
+		t1 = adlink_tsccorr_counter();
+		local_irq_restore(flags);
+
+		if (t1 - t0 < best) {
+			best = t1 - t0;
+			s->tsc = t0 + best / 2;
+			s->mono_ns = mono;
+		}
+	}
+
+	return best / 2;
+}
+
+/*
+ * Least squares fit of the window, relative to the newest sample. x is the
+ * nominal age in us, y how far CLOCK_MONOTONIC strayed from it in ns.
+ * Caller holds tc->lock.
+ */
+static void adlink_tsccorr_fit(struct adlink_tsccorr *tc, struct adlink_tsccorr_params *p)
+{
+	const struct adlink_tsccorr_sample *ref =
+		&tc->win[(tc->head + ADLINK_TSCCORR_WINDOW - 1) % ADLINK_TSCCORR_WINDOW];
+	s64 x[ADLINK_TSCCORR_WINDOW], y[ADLINK_TSCCORR_WINDOW];
+	s64 sx = 0, sy = 0, sxx = 0, sxy = 0, xm, ym, a, r;
+	u64 srr = 0, rmax = 0;
+	s64 ppb = 0;
+	unsigned int i, n = tc->count;
+
+	for (i = 0; i < n; i++) {
+		const struct adlink_tsccorr_sample *s = &tc->win[i];
+		s64 nominal = adlink_tsccorr_ticks_to_ns(s->tsc - ref->tsc, tc->mult, tc->shift);
+
+		x[i] = div_s64(nominal, NSEC_PER_USEC);
+		y[i] = (s64)(s->mono_ns - ref->mono_ns) - nominal;
+		sx += x[i];
+		sy += y[i];
+	}
+	xm = div_s64(sx, n);
+	ym = div_s64(sy, n);
+
+	for (i = 0; i < n; i++) {
+		sxx += (x[i] - xm) * (x[i] - xm);
+		sxy += (x[i] - xm) * (y[i] - ym);
+	}
+
+	// Slope in ns per us is 1e6 ppb, scale sxx down so that sxy cannot overflow
+	if (n >= 2 && sxx >= 1000000)
+		ppb = clamp_t(s64, div64_s64(sxy, div64_s64(sxx, 1000000)),
+			      -ADLINK_TSCCORR_MAX_PPB, ADLINK_TSCCORR_MAX_PPB);
+	a = ym - div_s64(ppb * xm, 1000000);
+
+	for (i = 0; i < n; i++) {
+		r = y[i] - a - div_s64(ppb * x[i], 1000000);
+		srr += r * r;
+		rmax = max_t(u64, rmax, abs(r));
+	}
+
+	tc->freq_ppb = ppb;
+	tc->residual_rms_ns = int_sqrt64(div_u64(srr, n));
+	tc->residual_max_ns = rmax;
+
+	p->tsc = ref->tsc;
+	p->mono_ns = ref->mono_ns + a;
+	p->mult = tc->mult + div_s64((s64)tc->mult * ppb, NSEC_PER_SEC);
+	p->shift = tc->shift;
+}
+
+static void adlink_tsccorr_publish(struct adlink_tsccorr *tc,
+				   const struct adlink_tsccorr_params *p)
+{
+	raw_write_seqcount_latch(&tc->latch);
+	tc->params[0] = *p;
+	raw_write_seqcount_latch(&tc->latch);
+	tc->params[1] = *p;
+}
+
+static void adlink_tsccorr_update(struct adlink_tsccorr *tc)
+{
+	struct adlink_tsccorr_sample s;
+	struct adlink_tsccorr_params p;
+	u64 skew, predicted;
+
+	mutex_lock(&tc->lock);
+
+	skew = adlink_tsccorr_read(&s);
+	p.real_off_ns = ktime_to_ns(ktime_mono_to_real(ns_to_ktime(s.mono_ns))) - s.mono_ns;
+
+	tc->read_skew_ns = mul_u64_u32_shr(skew, tc->mult, tc->shift);
+	tc->samples++;
+	if (adlink_tsccorr_convert(tc, s.tsc, NULL, &predicted)) {
+		tc->prediction_ns = s.mono_ns - predicted;
+		// Suspend or a counter jump, the old samples no longer line up
+		if (abs(tc->prediction_ns) > ADLINK_TSCCORR_RESET_NS) {
+			dev_warn(tc->dev, "TSC correlation off by %lld ns, restarting\n",
+				 tc->prediction_ns);
+			tc->count = 0;
+			tc->head = 0;
+			tc->resets++;
+		}
+	}
+
+	tc->win[tc->head] = s;
+	tc->head = (tc->head + 1) % ADLINK_TSCCORR_WINDOW;
+	tc->count = min(tc->count + 1, (unsigned int)ADLINK_TSCCORR_WINDOW);
+
+	adlink_tsccorr_fit(tc, &p);
+	adlink_tsccorr_publish(tc, &p);
+
+	mutex_unlock(&tc->lock);
+}
+
+static void adlink_tsccorr_work(struct work_struct *work)
+{
+	struct adlink_tsccorr *tc = container_of(to_delayed_work(work),
+						 struct adlink_tsccorr, work);
+
+	adlink_tsccorr_update(tc);
+	schedule_delayed_work(&tc->work, msecs_to_jiffies(READ_ONCE(tc->period_ms)));
+}
+
+static void adlink_tsccorr_stop(void *data)
+{
+	struct adlink_tsccorr *tc = data;
+
+	cancel_delayed_work_sync(&tc->work);
+}
+
+static ssize_t tsc_period_ms_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct adlink_tsccorr *tc = to_adlink_tsccorr(dev);
+
+	return sprintf(buf, "%u\n", READ_ONCE(tc->period_ms));
+}
+
+static ssize_t tsc_period_ms_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct adlink_tsccorr *tc = to_adlink_tsccorr(dev);
+	u32 val;
+	int ret;
+
+	ret = kstrtou32(buf, 0, &val);
+	if (ret)
+		return ret;
+	if (val < ADLINK_TSCCORR_PERIOD_MIN_MS || val > ADLINK_TSCCORR_PERIOD_MAX_MS)
+		return -EINVAL;
+
+	// The window mixes the old and the new spacing until it has refilled
+	WRITE_ONCE(tc->period_ms, val);
+	mod_delayed_work(system_wq, &tc->work, msecs_to_jiffies(val));
+
+	return count;
+}
+static DEVICE_ATTR_RW(tsc_period_ms);
+
+static ssize_t tsc_freq_ppb_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct adlink_tsccorr *tc = to_adlink_tsccorr(dev);
+	ssize_t ret;
+
+	mutex_lock(&tc->lock);
+	ret = sprintf(buf, "%lld\n", tc->freq_ppb);
+	mutex_unlock(&tc->lock);
+
+	return ret;
+}
+static DEVICE_ATTR_RO(tsc_freq_ppb);
+
+/* "<rms> <max> <prediction>": window residuals and the newest sample against the previous fit */
+static ssize_t tsc_residual_ns_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	struct adlink_tsccorr *tc = to_adlink_tsccorr(dev);
+	ssize_t ret;
+
+	mutex_lock(&tc->lock);
+	ret = sprintf(buf, "%llu %llu %lld\n", tc->residual_rms_ns,
+		      tc->residual_max_ns, tc->prediction_ns);
+	mutex_unlock(&tc->lock);
+
+	return ret;
+}
+static DEVICE_ATTR_RO(tsc_residual_ns);
+
+static ssize_t tsc_read_skew_ns_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
+{
+	struct adlink_tsccorr *tc = to_adlink_tsccorr(dev);
+	ssize_t ret;
+
+	mutex_lock(&tc->lock);
+	ret = sprintf(buf, "%llu\n", tc->read_skew_ns);
+	mutex_unlock(&tc->lock);
+
+	return ret;
+}
+static DEVICE_ATTR_RO(tsc_read_skew_ns);
+
+/* "<taken> <in window> <resets>" */
+static ssize_t tsc_samples_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct adlink_tsccorr *tc = to_adlink_tsccorr(dev);
+	ssize_t ret;
+
+	mutex_lock(&tc->lock);
+	ret = sprintf(buf, "%llu %u %llu\n", tc->samples, tc->count, tc->resets);
+	mutex_unlock(&tc->lock);
+
+	return ret;
+}
+static DEVICE_ATTR_RO(tsc_samples);
+
+static struct attribute *adlink_tsccorr_attrs[] = {
+	&dev_attr_tsc_period_ms.attr,
+	&dev_attr_tsc_freq_ppb.attr,
+	&dev_attr_tsc_residual_ns.attr,
+	&dev_attr_tsc_read_skew_ns.attr,
+	&dev_attr_tsc_samples.attr,
+	NULL,
+};
+
+static const struct attribute_group adlink_tsccorr_group = {
+	.attrs = adlink_tsccorr_attrs,
+};
+
+/*
+ * Take the first sample right away, so that adlink_tsccorr_convert() works
+ * as soon as this returns, then one every @period_ms.
+ */
+struct adlink_tsccorr *devm_adlink_tsccorr_create(struct device *dev, unsigned int period_ms)
+{
+	struct adlink_tsccorr *tc;
+	int ret;
+
+	tc = devres_alloc(adlink_tsccorr_devres_release, sizeof(*tc), GFP_KERNEL);
+	if (!tc)
+		return ERR_PTR(-ENOMEM);
+
+	tc->dev = dev;
+	seqcount_latch_init(&tc->latch);
+	mutex_init(&tc->lock);
+	INIT_DELAYED_WORK(&tc->work, adlink_tsccorr_work);
+	tc->period_ms = clamp_t(unsigned int, period_ms, ADLINK_TSCCORR_PERIOD_MIN_MS,
+				ADLINK_TSCCORR_PERIOD_MAX_MS);
+	clocks_calc_mult_shift(&tc->mult, &tc->shift, adlink_tsccorr_rate(),
+			       NSEC_PER_SEC, 3600);
+	devres_add(dev, tc);
+
+	ret = devm_device_add_group(dev, &adlink_tsccorr_group);
+	if (ret)
+		return ERR_PTR(ret);
+
+	adlink_tsccorr_update(tc);
+	schedule_delayed_work(&tc->work, msecs_to_jiffies(tc->period_ms));
+
+	ret = devm_add_action_or_reset(dev, adlink_tsccorr_stop, tc);
+	if (ret)
+		return ERR_PTR(ret);
+
+	return tc;
+}
+EXPORT_SYMBOL_GPL(devm_adlink_tsccorr_create);
@@ -1,5 +1,8 @@
 #!/bin/bash
 
+# tegra194_gte_test uses the event device and TSC correlator of the lib
+sudo insmod ./adlink-gpio-lib.ko
+
 # gpio_in=325 // PBB.01
 sudo insmod ./tegra194_gte_test.ko lic_irq=25 gpio_in=325 gpio_out=441
 
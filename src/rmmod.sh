@@ -1,3 +1,4 @@
 #!/bin/bash
 
 sudo rmmod tegra194_gte_test
+sudo rmmod adlink-gpio-lib
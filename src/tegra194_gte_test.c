@@ -16,9 +16,16 @@
 #include <linux/module.h>
 #include <linux/moduleparam.h>
 #include <linux/interrupt.h>
+#include <linux/platform_device.h>
 #include <linux/tegra-gte.h>
 #include <linux/gpio.h>
 #include <linux/timer.h>
+#include <linux/workqueue.h>
+#include <linux/spinlock.h>
+
+#include "adlink-gpio-event.h"
+#include "adlink-lib.h"
+#include "adlink-trace.h"
 
 /*
  * Sample GTE test driver demonstrating GTE API usage.
@@ -28,8 +35,19 @@
  *
  * Note: gpio_out and gpio_in need to be shorted externally using some wire
  * in order for this test driver to work for the GPIO monitoring.
+ *
+ * Every GTE event pending for either source is drained into the event ring
+ * of /dev/adlink-gte-tegra_gte_test, from the gpio_in ISR and every
+ * drain_ms. The TSC stamps are converted to CLOCK_REALTIME (ns) and
+ * CLOCK_MONOTONIC (mono_ns) by the TSC correlator of adlink-gpio-lib, which
+ * samples every sync_ms. Channel 0 is gpio_in, channel 1 is lic_irq.
  */
 
+#define DRIVER_NAME "tegra_gte_test"
+#define GTE_CH_GPIO	0
+#define GTE_CH_LIC	1
+#define GTE_DRAIN_MAX	256	/* events per source and drain, bounds the IRQ-off time */
+
 /*
  * This represents global ID of the GPIO since global ID or logical
  * partitioning of the GPIOs across various GPIO controller happens
@@ -53,14 +71,97 @@ module_param(gpio_out, int, 0660);
 static int lic_irq = -EINVAL;
 module_param(lic_irq, int, 0660);
 
+/* Period of the drain */
+static unsigned int drain_ms = 10;
+module_param(drain_ms, uint, 0644);
+MODULE_PARM_DESC(drain_ms, "Period of the GTE drain in ms");
+
+/* Initial period of the TSC correlation, tsc_period_ms in sysfs afterwards */
+static unsigned int sync_ms = 1000;
+module_param(sync_ms, uint, 0444);
+MODULE_PARM_DESC(sync_ms, "Period of the TSC to system clock samples in ms");
+
 static struct tegra_gte_test {
 	struct tegra_gte_ev_desc *data_lic;
 	struct tegra_gte_ev_desc *data_gpio;
 	int gpio_in_irq;
 	struct timer_list timer;
 	struct kobject *kobj;
+
+	struct platform_device *pdev;
+	int probe_ret;			/* module init fails with it */
+	struct adlink_evdev *evdev;
+	struct adlink_tsccorr *tsccorr;
+	raw_spinlock_t lock;		/* the event descriptors and the ring producer */
+	struct delayed_work drain_work;
+	struct adlink_gpio_event last_lic;	/* for lic_irq_ts */
+	u64 drained;
 } gte;
 
+/* Caller holds gte.lock */
+static void gte_test_drain_one(struct tegra_gte_ev_desc *desc, u32 channel, int irq)
+{
+	struct adlink_gpio_event rec = {
+		.flags = ADLINK_GPIO_EVENT_HWTS,
+		.channel = channel,
+	};
+	struct tegra_gte_ev_detail hts;
+	unsigned int n;
+
+	for (n = 0; desc && n < GTE_DRAIN_MAX; n++) {
+		if (tegra_gte_retrieve_event(desc, &hts))
+			break;
+
+		rec.raw = hts.ts_raw;
+		adlink_tsccorr_convert(gte.tsccorr, hts.ts_raw, &rec.ns, &rec.mono_ns);
+		rec.seq = adlink_evdev_push_event(gte.evdev, &rec);
+		trace_adlink_gpio_edge(irq, channel, rec.seq, rec.ns, rec.raw, rec.flags);
+		if (channel == GTE_CH_LIC)
+			gte.last_lic = rec;
+		gte.drained++;
+	}
+}
+
+static void gte_test_drain(void)
+{
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&gte.lock, flags);
+	gte_test_drain_one(gte.data_gpio, GTE_CH_GPIO, gte.gpio_in_irq);
+	gte_test_drain_one(gte.data_lic, GTE_CH_LIC, lic_irq);
+	raw_spin_unlock_irqrestore(&gte.lock, flags);
+}
+
+static void gte_test_drain_work(struct work_struct *work)
+{
+	gte_test_drain();
+
+	schedule_delayed_work(&gte.drain_work, msecs_to_jiffies(max(drain_ms, 1U)));
+}
+
+/* Detach @desc from the drain before it is unregistered */
+static struct tegra_gte_ev_desc *gte_test_detach(struct tegra_gte_ev_desc **desc)
+{
+	struct tegra_gte_ev_desc *old;
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&gte.lock, flags);
+	old = *desc;
+	*desc = NULL;
+	raw_spin_unlock_irqrestore(&gte.lock, flags);
+
+	return old;
+}
+
+static void gte_test_attach(struct tegra_gte_ev_desc **desc, struct tegra_gte_ev_desc *ev)
+{
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&gte.lock, flags);
+	*desc = ev;
+	raw_spin_unlock_irqrestore(&gte.lock, flags);
+}
+
 /*
  * Sysfs attribute to register/unregister GTE gpio event for 1 and 0 values
  */
@@ -71,6 +172,7 @@ static ssize_t store_gpio_en_dis(struct kobject *kobj,
 	int ret = count;
 	unsigned long val = 0;
 	struct device_node *np;
+	struct tegra_gte_ev_desc *ev;
 	np = of_find_compatible_node(NULL, NULL, "nvidia,tegra194-gte-aon");
 
 	if (!np) {
@@ -93,13 +195,13 @@ static ssize_t store_gpio_en_dis(struct kobject *kobj,
 			goto error;
 		}
 		pr_info("registering gpio_in...\n");
-		gte.data_gpio = tegra_gte_register_event(np, gpio_in);
-		if (IS_ERR(gte.data_gpio)) {
+		ev = tegra_gte_register_event(np, gpio_in);
+		if (IS_ERR(ev)) {
 			pr_err("Could not register gpio\n");
-			ret = PTR_ERR(gte.data_gpio);
-			gte.data_gpio = NULL;
+			ret = PTR_ERR(ev);
 			goto error;
 		}
+		gte_test_attach(&gte.data_gpio, ev);
 		pr_info("gpio_in registered!\n");
 	} else if (val == 0) {
 		if (!gte.data_gpio) {
@@ -108,15 +210,15 @@ static ssize_t store_gpio_en_dis(struct kobject *kobj,
 			goto error;
 		}
 		pr_info("un-registering gpio_in...\n");
-		ret = tegra_gte_unregister_event(gte.data_gpio);
+		ev = gte_test_detach(&gte.data_gpio);
+		ret = tegra_gte_unregister_event(ev);
 		if (ret == -EBUSY) {
 			/* User should retry */
 			pr_err("failed to unregister gpio in\n");
+			gte_test_attach(&gte.data_gpio, ev);
 			goto error;
-		} else { /* For anything else set data to null */
-			gte.data_gpio = NULL;
-			if (ret == 0)
-				ret = count;
+		} else if (ret == 0) {
+			ret = count;
 		}
 	} else {
 		ret = -EINVAL;
@@ -137,6 +239,7 @@ static ssize_t store_lic_irq_en_dis(struct kobject *kobj,
 	int ret = count;
 	unsigned long val = 0;
 	struct device_node *np;
+	struct tegra_gte_ev_desc *ev;
 	np = of_find_compatible_node(NULL, NULL, "nvidia,tegra194-gte-lic");
 
 	if (!np) {
@@ -155,28 +258,28 @@ static ssize_t store_lic_irq_en_dis(struct kobject *kobj,
 			ret = -EEXIST;
 			goto error;
 		}
-		gte.data_lic = tegra_gte_register_event(np, lic_irq);
-		if (IS_ERR(gte.data_lic)) {
+		ev = tegra_gte_register_event(np, lic_irq);
+		if (IS_ERR(ev)) {
 			pr_err("Could not register lic irq\n");
-			ret = PTR_ERR(gte.data_lic);
-			gte.data_lic = NULL;
+			ret = PTR_ERR(ev);
 			goto error;
 		}
+		gte_test_attach(&gte.data_lic, ev);
 	} else if (val == 0) {
 		if (!gte.data_lic) {
 			pr_info("lic_irq is not registered\n");
 			ret = -EINVAL;
 			goto error;
 		}
-		ret = tegra_gte_unregister_event(gte.data_lic);
+		ev = gte_test_detach(&gte.data_lic);
+		ret = tegra_gte_unregister_event(ev);
 		if (ret == -EBUSY) {
 			/* User should retry */
 			pr_err("failed to unregister lic irq\n");
+			gte_test_attach(&gte.data_lic, ev);
 			goto error;
-		} else { /* For anything else set data to null */
-			gte.data_lic = NULL;
-			if (ret == 0)
-				ret = count;
+		} else if (ret == 0) {
+			ret = count;
 		}
 	} else {
 		ret = -EINVAL;
@@ -187,20 +290,33 @@ error:
 	return ret;
 }
 
-/* Shows LIC event timestamp information */
+/* Shows the last drained LIC event, the events themselves go to the ring */
 static ssize_t show_lic_irq_ts(struct kobject *kobj,
 				   struct kobj_attribute *attr,
 				   char *buf)
 {
-	struct tegra_gte_ev_detail hts;
+	struct adlink_gpio_event ev;
+	unsigned long flags;
+
+	gte_test_drain();
 
-	if (tegra_gte_retrieve_event((gte.data_lic), &hts) != 0)
+	raw_spin_lock_irqsave(&gte.lock, flags);
+	ev = gte.last_lic;
+	raw_spin_unlock_irqrestore(&gte.lock, flags);
+
+	if (!ev.raw)
 		return -EINVAL;
 
-	pr_debug("Retrieved lic event ts_raw: %llu, ts_ns %llu\n",
-		 hts.ts_raw, hts.ts_ns);
-	return scnprintf(buf, PAGE_SIZE, "ts_raw: %llu, ts_ns: %llu\n",
-			 hts.ts_raw, hts.ts_ns);
+	return scnprintf(buf, PAGE_SIZE, "ts_raw: %llu, realtime_ns: %llu, monotonic_ns: %llu\n",
+			 ev.raw, ev.ns, ev.mono_ns);
+}
+
+/* Events moved into the ring so far */
+static ssize_t show_drained(struct kobject *kobj,
+			    struct kobj_attribute *attr,
+			    char *buf)
+{
+	return scnprintf(buf, PAGE_SIZE, "%llu\n", READ_ONCE(gte.drained));
 }
 
 struct kobj_attribute gpio_en_dis_attr =
@@ -209,11 +325,14 @@ struct kobj_attribute lic_irq_en_dis_attr =
 		__ATTR(lic_irq_en_dis, 0220, NULL, store_lic_irq_en_dis);
 struct kobj_attribute lic_irq_ts_attr =
 		__ATTR(lic_irq_ts, 0440, show_lic_irq_ts, NULL);
+struct kobj_attribute drained_attr =
+		__ATTR(drained, 0444, show_drained, NULL);
 
 static struct attribute *attrs[] = {
 	&gpio_en_dis_attr.attr,
 	&lic_irq_en_dis_attr.attr,
 	&lic_irq_ts_attr.attr,
+	&drained_attr.attr,
 	NULL,
 };
 
@@ -250,31 +369,35 @@ static void gpio_timer_cb(struct timer_list *t)
 
 static irqreturn_t tegra_gte_test_gpio_isr(int irq, void *data)
 {
-	struct tegra_gte_ev_detail hts;
-	struct tegra_gte_test *gte = data;
-	
-	if (tegra_gte_retrieve_event((gte->data_gpio), &hts) != 0) {
-		pr_info("No timestamp available\n");
-		return IRQ_HANDLED;
-	}
+	// Takes this edge and anything that queued up since the last drain
+	gte_test_drain();
 
-	pr_info("GPIO HW Timestamp: raw %llu, ns %llu\n",
-		 hts.ts_raw, hts.ts_ns);
 	return IRQ_HANDLED;
 }
 
-static int __init tegra_gte_test_init(void)
+static int tegra_gte_test_setup(struct platform_device *pdev)
 {
 	int ret = 0;
 
-	if (gpio_out == -EINVAL || gpio_in == -EINVAL || lic_irq == EINVAL) {
-		pr_err("Invalid gpio_out, gpio_in and irq\n");
-		return -EINVAL;
-	}
-
 	gte.data_lic = NULL;
 	gte.data_gpio = NULL;
 
+	INIT_DELAYED_WORK(&gte.drain_work, gte_test_drain_work);
+
+	/* TSC correlation setup, the ISR converts with it */
+	gte.tsccorr = devm_adlink_tsccorr_create(&pdev->dev, sync_ms);
+	if (IS_ERR(gte.tsccorr)) {
+		pr_err("failed to set up TSC correlation\n");
+		return PTR_ERR(gte.tsccorr);
+	}
+
+	/* Event ring, before the IRQ so that it is released after it */
+	gte.evdev = devm_adlink_evdev_create(&pdev->dev, "adlink-gte");
+	if (IS_ERR(gte.evdev)) {
+		pr_err("failed to create event device\n");
+		return PTR_ERR(gte.evdev);
+	}
+
 	ret = gpio_request(gpio_out, "gte_test_gpio_out");
 	if (ret) {
 		pr_err("failed request gpio out\n");
@@ -313,13 +436,15 @@ static int __init tegra_gte_test_init(void)
 
 	gte.gpio_in_irq = ret;
 
+	schedule_delayed_work(&gte.drain_work, msecs_to_jiffies(max(drain_ms, 1U)));
+
 	ret = request_irq(ret, tegra_gte_test_gpio_isr,
 			 IRQF_TRIGGER_RISING | IRQF_NO_THREAD,
 			 "tegra_gte_test_isr", &gte);
 	if (ret) {
 		pr_err("failed to acquire IRQ\n");
 		ret = -EINVAL;
-		goto free_gpio_in;
+		goto cancel_drain;
 	}
 
 	ret = tegra_gte_test_sysfs_create();
@@ -341,6 +466,8 @@ static int __init tegra_gte_test_init(void)
 
 free_irq:
 	free_irq(gte.gpio_in_irq, &gte);
+cancel_drain:
+	cancel_delayed_work_sync(&gte.drain_work);
 free_gpio_in:
 	gpio_free(gpio_in);
 free_gpio_out:
@@ -349,15 +476,72 @@ free_gpio_out:
 	return ret;
 }
 
-static void __exit tegra_gte_test_exit(void)
+static int tegra_gte_test_probe(struct platform_device *pdev)
+{
+	gte.probe_ret = tegra_gte_test_setup(pdev);
+
+	return gte.probe_ret;
+}
+
+static int tegra_gte_test_remove(struct platform_device *pdev)
 {
+	kobject_put(gte.kobj);
+	del_timer_sync(&gte.timer);
 	free_irq(gte.gpio_in_irq, &gte);
+	cancel_delayed_work_sync(&gte.drain_work);
 	gpio_free(gpio_in);
 	gpio_free(gpio_out);
-	tegra_gte_unregister_event(gte.data_gpio);
-	tegra_gte_unregister_event(gte.data_lic);
-	kobject_put(gte.kobj);
-	del_timer(&gte.timer);
+	tegra_gte_unregister_event(gte_test_detach(&gte.data_gpio));
+	tegra_gte_unregister_event(gte_test_detach(&gte.data_lic));
+
+	return 0;
+}
+
+static struct platform_driver tegra_gte_test_driver = {
+	.probe		= tegra_gte_test_probe,
+	.remove		= tegra_gte_test_remove,
+	.driver		= {
+		.name	= DRIVER_NAME,
+	},
+};
+
+static int __init tegra_gte_test_init(void)
+{
+	int ret;
+
+	if (gpio_out == -EINVAL || gpio_in == -EINVAL || lic_irq == -EINVAL) {
+		pr_err("Invalid gpio_out, gpio_in and irq\n");
+		return -EINVAL;
+	}
+
+	raw_spin_lock_init(&gte.lock);
+
+	ret = platform_driver_register(&tegra_gte_test_driver);
+	if (ret)
+		return ret;
+
+	// The event ring is a devm resource, so it needs a bound device
+	gte.probe_ret = -ENODEV;
+	gte.pdev = platform_device_register_simple(DRIVER_NAME, PLATFORM_DEVID_NONE, NULL, 0);
+	if (IS_ERR(gte.pdev)) {
+		platform_driver_unregister(&tegra_gte_test_driver);
+		return PTR_ERR(gte.pdev);
+	}
+
+	// The device registers fine even if the probe fails, so check that too
+	if (gte.probe_ret) {
+		platform_device_unregister(gte.pdev);
+		platform_driver_unregister(&tegra_gte_test_driver);
+		return gte.probe_ret;
+	}
+
+	return 0;
+}
+
+static void __exit tegra_gte_test_exit(void)
+{
+	platform_device_unregister(gte.pdev);
+	platform_driver_unregister(&tegra_gte_test_driver);
 }
 
 module_init(tegra_gte_test_init);